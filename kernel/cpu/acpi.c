@@ -8,7 +8,9 @@
 #include <dev/pci.h>
 
 #include <lib/memory.h>
+#include <mem/arena.h>
 #include <mem/heap.h>
+#include <mem/slab.h>
 #include <mem/vmm.h>
 #include <stddef.h>// For LAI
 
@@ -25,9 +27,22 @@ static volatile struct limine_smbios_request smbios_request = {
         .revision = 0,
 };
 
+// Namespace nodes created while the namespace is built live as long as the kernel, they come from an arena instead of
+// the node cache. Everything else, AML temporaries and the hashtables that are reallocated as they grow, stays on
+// kmalloc where freeing it gives the memory back.
+static KmArena kLaiArena;
+static uint8_t kLaiUseArena = 0;
+
 static void AcpiInitializeFadt(AcpiFadt *fadt) {
 }
 
+// Tables are reached through the direct map, firmware regions it does not cover get mapped on the way.
+static AcpiTableHeader *AcpiMapTable(uint64_t address) {
+    AcpiTableHeader *header = (AcpiTableHeader *) MmMapPhysical(address, sizeof(AcpiTableHeader));
+    MmMapPhysical(address, header->length);
+    return header;
+}
+
 void AcpiInitialize(void) {
     AcpiRootSystemDescriptionPointer *rsdp = rsdp_request.response->address;
 
@@ -36,7 +51,7 @@ void AcpiInitialize(void) {
 
     ComPrint("[ACPI] RSDP OEM: %c%c%c%c%c%c\n", rsdp->oem_id[0], rsdp->oem_id[1], rsdp->oem_id[2], rsdp->oem_id[3], rsdp->oem_id[4], rsdp->oem_id[5]);
 
-    AcpiXsdt *xsdt = (AcpiXsdt *) rsdp->xsdt_address;
+    AcpiXsdt *xsdt = (AcpiXsdt *) AcpiMapTable(rsdp->xsdt_address);
 
     AcpiMadt *madt = 0;
     AcpiFadt *fadt = 0;
@@ -47,7 +62,7 @@ void AcpiInitialize(void) {
     ComPrint("[ACPI] Available tables (%d total) (Revision %d):\n", length, rsdp->revision);
 
     for (int i = 0; i < length; i++) {
-        AcpiTableHeader *header = (AcpiTableHeader *) xsdt->pointers[i];
+        AcpiTableHeader *header = AcpiMapTable(xsdt->pointers[i]);
         ComPrint("[ACPI]   0x%X: %c%c%c%c\n", header, header->signature & 0xFF, (header->signature >> 8) & 0xFF, (header->signature >> 16) & 0xFF, (header->signature >> 24) & 0xFF);
 
         switch (header->signature) {
@@ -65,7 +80,17 @@ void AcpiInitialize(void) {
 
 #ifdef ACPI_USE_LAI
     lai_set_acpi_revision(rsdp->revision);
+
+    // Nodes created while the namespace is built live as long as the namespace does.
+    KmArenaInitialize(&kLaiArena, "lai-namespace");
+    kLaiUseArena = 1;
     lai_create_namespace();
+    kLaiUseArena = 0;
+
+    KmArenaStatistics arena;
+    KmArenaGetStatistics(&kLaiArena, &arena);
+    ComPrint("[ACPI] Namespace arena: %D of %D bytes used in %D chunks, %D nodes freed early\n", arena.used,
+             arena.reserved, arena.chunks, arena.unreclaimed);
 
     lai_enable_acpi(1);
 
@@ -92,12 +117,33 @@ __attribute__((noreturn)) void laihost_panic(const char *msg) {
         ;
 }
 
+// Namespace nodes are by far the most common LAI allocation. LAI passes the size of the block to laihost_free, so
+// routing by size sends every node back to the cache it came from.
+static KmCache *kLaiNodeCache = 0;
+
 void *laihost_malloc(size_t size) {
+    if (size == sizeof(lai_nsnode_t) && kLaiUseArena)
+        return KmArenaAlloc(&kLaiArena, size, 0);
+
+    if (size == sizeof(lai_nsnode_t)) {
+        if (!kLaiNodeCache)
+            kLaiNodeCache = KmCacheCreate("lai_nsnode_t", sizeof(lai_nsnode_t), 0, 0);
+        return KmCacheAlloc(kLaiNodeCache);
+    }
+
     return kmalloc(size);
 }
 
 void laihost_free(void *ptr, size_t size) {
-    (void) size;
+    // Only nodes can come from the arena, no other free has to look it up.
+    if (size == sizeof(lai_nsnode_t)) {
+        if (kLaiArena.chunk && KmArenaOwns(&kLaiArena, ptr))
+            KmArenaFree(&kLaiArena, ptr);
+        else
+            KmCacheFree(kLaiNodeCache, ptr);
+        return;
+    }
+
     kfree(ptr);
 }
 
@@ -106,42 +152,41 @@ void *laihost_realloc(void *ptr, size_t size, size_t old_size) {
         return ptr;
 
     if (size == 0) {
-        kfree(ptr);
+        laihost_free(ptr, old_size);
         return 0;
     }
 
     if (!ptr)
-        return kmalloc(size);
+        return laihost_malloc(size);
 
-    void *new_ptr = kmalloc(size);
-    RtCopyMemory(new_ptr, ptr, old_size);
-    kfree(ptr);
+    // Strings, buffers and packages grow one step at a time, krealloc extends them in place where it can.
+    if (size != sizeof(lai_nsnode_t) && old_size != sizeof(lai_nsnode_t))
+        return krealloc(ptr, size);
+
+    void *new_ptr = laihost_malloc(size);
+    RtCopyMemory(new_ptr, ptr, old_size < size ? old_size : size);
+    laihost_free(ptr, old_size);
 
     return new_ptr;
 }
 
 void *laihost_map(size_t address, size_t count) {
-    address &= ~0xFFF;
-    for (size_t i = 0; i < count; i += PAGE_SIZE)
-        MmMapMemory((void *) address + i, (void *) address + i);
-    return (void *) address;
+    return MmMapPhysical(address, count);
 }
 
 void laihost_unmap(void *address, size_t count) {
-    (void) address;
-    (void) count;
-    ComPrint("[LAI] Unmapping is not supported!\n");
+    MmUnmapPhysical(address, count);
 }
 
 void *laihost_scan(const char *sig, size_t index) {
     AcpiRootSystemDescriptionPointer *rsdp = rsdp_request.response->address;
-    AcpiXsdt *xsdt = (AcpiXsdt *) rsdp->xsdt_address;
+    AcpiXsdt *xsdt = (AcpiXsdt *) AcpiMapTable(rsdp->xsdt_address);
 
     ComPrint("[LAI] Scanning for %s (%d)\n", sig, index);
 
     int length = (xsdt->header.length - sizeof(AcpiTableHeader)) / sizeof(uint64_t);
     for (int i = 0; i < length; i++) {
-        AcpiTableHeader *header = (AcpiTableHeader *) xsdt->pointers[i];
+        AcpiTableHeader *header = AcpiMapTable(xsdt->pointers[i]);
         if (header->signature == *(uint32_t *) sig) {
             if (index == 0)
                 return header;
@@ -151,10 +196,10 @@ void *laihost_scan(const char *sig, size_t index) {
 
     if (*(uint32_t *) sig == ACPI_DSDT_ID) {
         for (int i = 0; i < length; i++) {
-            AcpiTableHeader *header = (AcpiTableHeader *) xsdt->pointers[i];
+            AcpiTableHeader *header = AcpiMapTable(xsdt->pointers[i]);
             if (header->signature == ACPI_FADT_ID) {
                 AcpiFadt *fadt = (AcpiFadt *) header;
-                return (void *) fadt->x_dsdt;
+                return AcpiMapTable(fadt->x_dsdt);
             }
         }
     }
@@ -2,6 +2,9 @@
 #include "intel.h"
 
 #include <lib/list.h>
+#include <lib/rbtree.h>
+#include <mem/slab.h>
+#include <mem/vma.h>
 #include <mem/vmm.h>
 #include <utl/serial.h>
 
@@ -92,11 +95,13 @@ typedef struct IoApic {
     uintptr_t phys_addr;
     uintptr_t address;
 
-    LIST_ENTRY(struct IoApic) list;
+    RbNode node;
 } IoApic;
 
 LIST_HEAD(LocalApic) kLocalApics = LIST_HEAD_INIT;
-LIST_HEAD(IoApic) kIoApics = LIST_HEAD_INIT;
+// IO APICs are ordered by their GSI base, the ranges they cover don't overlap.
+RbTree kIoApics = RB_TREE_INIT;
+static KmCache *kIoApicCache = 0;
 
 uint32_t kNumLocalApics = 0, kNumIoApics = 0;
 
@@ -127,9 +132,21 @@ static void IoApicWrite64(uintptr_t address, uint8_t index, uint64_t value) {
     *(volatile uint32_t *) (address + IOREGWIN) = value >> 32;
 }
 
+static int IoApicCompare(RbNode *a, RbNode *b) {
+    IoApic *left = RB_CONTAINER(a, IoApic, node);
+    IoApic *right = RB_CONTAINER(b, IoApic, node);
+    return left->gsi_base < right->gsi_base ? -1 : left->gsi_base > right->gsi_base;
+}
+
+// An IRQ compares equal to the IO APIC whose pins cover it.
+static int IoApicCompareIrq(RbNode *node, void *key) {
+    IoApic *ioapic = RB_CONTAINER(node, IoApic, node);
+    return IoApicCompareRange(ioapic->gsi_base, ioapic->max_rentry, (uint64_t) key);
+}
+
 static IoApic *IoApicGetById(uint8_t id) {
     IoApic *ioapic = 0;
-    LIST_FOREACH(ioapic, &kIoApics, list) {
+    RB_FOREACH(ioapic, &kIoApics, IoApic, node) {
         if (ioapic->id == id) {
             return ioapic;
         }
@@ -138,18 +155,12 @@ static IoApic *IoApicGetById(uint8_t id) {
 }
 
 static IoApic *IoApicGetByIrq(uint8_t irq) {
-    IoApic *ioapic = 0;
-    LIST_FOREACH(ioapic, &kIoApics, list) {
-        if (ioapic->gsi_base <= irq &&
-            irq < ioapic->gsi_base + ioapic->max_rentry)
-            return ioapic;
-    }
-    return 0;
+    return RB_FIND(&kIoApics, (void *) (uint64_t) irq, IoApicCompareIrq, IoApic, node);
 }
 
 void ApicInitialize(AcpiMadt *madt) {
-    MmMapMemory((void *) (uint64_t) madt->local_apic_address, (void *) (uint64_t) madt->local_apic_address);
-    kLocalApicAddress = (uint64_t) madt->local_apic_address;
+    kIoApicCache = KmCacheCreate("IoApic", sizeof(IoApic), KM_CACHE_LINE, 0);
+    kLocalApicAddress = (uint64_t) ioremap(madt->local_apic_address, PAGE_SIZE, MM_MEMORY_UC);
 
     AcpiMadtInterruptOverride *overrides[ISA_NUM_IRQS] = {0};
 
@@ -180,13 +191,11 @@ void ApicInitialize(AcpiMadt *madt) {
             case ACPI_MADT_TYPE_IO_APIC: {
                 AcpiMadtIoApic *ioapic_data = (AcpiMadtIoApic *) entry;
 
-                IoApic *ioapic = (IoApic *) kmalloc(sizeof(IoApic));
+                IoApic *ioapic = (IoApic *) KmCacheAlloc(kIoApicCache);
                 ioapic->id = ioapic_data->io_apic_id;
                 ioapic->gsi_base = ioapic_data->gsi_base;
                 ioapic->phys_addr = ioapic_data->address;
-                ioapic->address = ioapic->phys_addr;
-
-                MmMapMemory((void *) ioapic->address, (void *) ioapic->address);
+                ioapic->address = (uint64_t) ioremap(ioapic->phys_addr, PAGE_SIZE, MM_MEMORY_UC);
 
                 uint32_t version = IoApicRead(ioapic->address, IOAPIC_VERSION);
                 ioapic->max_rentry = (version >> 16) & 0xFF;
@@ -199,7 +208,7 @@ void ApicInitialize(AcpiMadt *madt) {
                     IoApicWrite64(ioapic->address, IOAPIC_RENTRY_BASE + 2 * i, rentry.raw);
                 }
 
-                LIST_ADD(&kIoApics, ioapic, list);
+                RB_INSERT(&kIoApics, ioapic, IoApicCompare, node);
                 kNumIoApics++;
 
                 ComPrint("[APIC] IOAPIC %d at 0x%X (GSI: 0x%X)\n", ioapic_data->io_apic_id, ioapic_data->address, ioapic_data->gsi_base);
@@ -218,13 +227,8 @@ void ApicInitialize(AcpiMadt *madt) {
 }
 
 int ApicGetHighestIrq() {
-    int highest = 0;
-    IoApic *ioapic = 0;
-    LIST_FOREACH(ioapic, &kIoApics, list) {
-        if (ioapic->gsi_base + ioapic->max_rentry > highest)
-            highest = ioapic->gsi_base + ioapic->max_rentry;
-    }
-    return highest;
+    IoApic *ioapic = RB_LAST(&kIoApics, IoApic, node);
+    return ioapic ? ioapic->gsi_base + ioapic->max_rentry : 0;
 }
 
 
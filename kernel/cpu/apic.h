@@ -12,6 +12,14 @@ void ApicInitializeInterrupts();
 
 int ApicGetHighestIrq();
 
+// Compares `irq` with the pins of an IO APIC, which run from gsi_base up to and including gsi_base + max_rentry.
+// Negative when all pins lie below the IRQ, positive when they lie above it.
+static inline int IoApicCompareRange(uint32_t gsi_base, uint8_t max_rentry, uint64_t irq) {
+    if ((uint64_t) gsi_base + max_rentry < irq)
+        return -1;
+    return gsi_base > irq;
+}
+
 int ApicSetIrqIsaRouting(uint8_t isa_irq, uint8_t vector, uint16_t flags);
 int ApicSetIrqVector(uint8_t irq, uint8_t vector);
 int ApicSetIrqDest(uint8_t irq, uint8_t mode, uint8_t dest);
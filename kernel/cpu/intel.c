@@ -121,4 +121,17 @@ void IntelSetCR3(void *cr3) {
     __asm__ volatile("movq %0, %%cr3"
                      :
                      : "r"(cr3));
-}
\ No newline at end of file
+}
+
+uint64_t IntelGetCR4(void) {
+    uint64_t cr4;
+    __asm__ volatile("movq %%cr4, %0"
+                     : "=r"(cr4));
+    return cr4;
+}
+
+void IntelSetCR4(uint64_t cr4) {
+    __asm__ volatile("movq %0, %%cr4"
+                     :
+                     : "r"(cr4));
+}
@@ -96,6 +96,9 @@ void IntelInitialize(uint64_t kernel_stack);
 void *IntelGetCR3(void);
 void IntelSetCR3(void *cr3);
 
+uint64_t IntelGetCR4(void);
+void IntelSetCR4(uint64_t cr4);
+
 static inline uint8_t IoIn8(uint16_t port) {
     uint8_t ret;
     __asm__ volatile("inb %1, %0"
@@ -132,6 +135,70 @@ static inline void IoOut32(uint16_t port, uint32_t val) {
     __asm__ volatile("outl %0, %1" ::"a"(val), "Nd"(port));
 }
 
+#ifdef HOST_BUILD
+// The host build runs as an ordinary process, where there are no interrupts to mask.
+static inline uint64_t IntelDisableInterrupts(void) {
+    return 0;
+}
+
+static inline void IntelRestoreInterrupts(uint64_t flags) {
+    (void) flags;
+}
+#else
+static inline uint64_t IntelDisableInterrupts(void) {
+    uint64_t flags;
+    __asm__ volatile("pushfq; popq %0; cli"
+                     : "=r"(flags)::"memory");
+    return flags;
+}
+
+static inline void IntelRestoreInterrupts(uint64_t flags) {
+    if (flags & (1 << 9))
+        __asm__ volatile("sti" ::: "memory");
+}
+#endif
+
+static inline uint64_t IntelReadMsr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile("rdmsr"
+                     : "=a"(low), "=d"(high)
+                     : "c"(msr));
+    return ((uint64_t) high << 32) | low;
+}
+
+static inline void IntelWriteMsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" ::"c"(msr), "a"((uint32_t) value), "d"((uint32_t) (value >> 32)));
+}
+
+static inline void IntelWriteBackInvalidate(void) {
+    __asm__ volatile("wbinvd" ::: "memory");
+}
+
+static inline uint64_t IntelReadTsc(void) {
+    uint32_t low, high;
+    __asm__ volatile("rdtsc"
+                     : "=a"(low), "=d"(high));
+    return ((uint64_t) high << 32) | low;
+}
+
+static inline void IntelCpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile("cpuid"
+                     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t IntelGetCR2(void) {
+    uint64_t cr2;
+    __asm__ volatile("mov %%cr2, %0"
+                     : "=r"(cr2));
+    return cr2;
+}
+
+static inline void IntelInvalidatePage(void *address) {
+    __asm__ volatile("invlpg (%0)" ::"r"(address)
+                     : "memory");
+}
+
 static inline void IoWait(void) {
     __asm__ volatile("outb %%al, $0x80"
                      :
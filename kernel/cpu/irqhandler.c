@@ -1,6 +1,8 @@
 #include "apic.h"
 #include "intel.h"
 
+#include <lib/bitmap.h>
+#include <mem/vmm.h>
 #include <utl/serial.h>
 
 #define IRQ_NUM_VECTORS 256
@@ -30,14 +32,11 @@ static IrqIsaOverride kIrqIsaOverrides[IRQ_NUM_ISA];
 
 static int kApicHighestIrq = 0;
 
-static uint8_t kIrqSwBitmap[IRQ_NUM_VECTORS / 8];
-static uint8_t kIrqHwBitmap[IRQ_NUM_VECTORS / 8];
+static uint64_t kIrqSwWords[BITMAP_WORDS(IRQ_NUM_VECTORS)];
+static uint64_t kIrqHwWords[BITMAP_WORDS(IRQ_NUM_VECTORS)];
 
-#define SW_BITMAP_GET(index) (kIrqSwBitmap[(index) / 8] & (1 << ((index) % 8)))
-#define SW_BITMAP_SET(index) (kIrqSwBitmap[(index) / 8] |= (1 << ((index) % 8)))
-
-#define HW_BITMAP_GET(index) (kIrqHwBitmap[(index) / 8] & (1 << ((index) % 8)))
-#define HW_BITMAP_SET(index) (kIrqHwBitmap[(index) / 8] |= (1 << ((index) % 8)))
+static Bitmap kIrqSwBitmap = {kIrqSwWords, IRQ_NUM_VECTORS};
+static Bitmap kIrqHwBitmap = {kIrqHwWords, IRQ_NUM_VECTORS};
 
 static uint8_t kIpiVector;
 
@@ -53,6 +52,10 @@ __attribute__((used)) void IrqHandler(uint8_t vector) {
 }
 
 __attribute__((used)) void ExcHandler(uint8_t vector, uint32_t error, CpuStack *frame, CpuRegisters *regs) {
+    // Faults inside lazily committed regions are resolved here, the faulting instruction simply runs again.
+    if (vector == 14 && MmHandlePageFault(IntelGetCR2(), error))
+        return;
+
     // HACK HACK
     uint32_t volatile *eoi = (uint32_t volatile *)(kLocalApicAddress + 0xB0);
     *eoi = 0;
@@ -66,10 +69,7 @@ __attribute__((used)) void ExcHandler(uint8_t vector, uint32_t error, CpuStack *
         ComPrint("[INTR]    Error code: %d\n", error);
         ComPrint("[INTR]    RAX: %X RBX: %X RCX: %X RDX: %X\n", regs->rax, regs->rbx, regs->rcx, regs->rdx);
         ComPrint("[INTR]    RSI: %X RDI: %X RBP: %X\n", regs->rsi, regs->rdi, regs->rbp);
-        uint64_t cr2;
-        __asm__ volatile("mov %%cr2, %0"
-                         : "=r"(cr2));
-        ComPrint("[INTR]    CR2: %X\n", cr2);
+        ComPrint("[INTR]    CR2: %X\n", IntelGetCR2());
     }
 
     while (1) {
@@ -82,17 +82,12 @@ void ApicInitializeInterrupts(void) {
 
     ComPrint("[INTR] Highest IRQ: %d\n", kApicHighestIrq);
 
-    for (int bm = IRQ_NUM_VECTORS - IRQ_VECTOR_BASE; bm < IRQ_NUM_VECTORS; bm++) {
-        SW_BITMAP_SET(bm);
-        HW_BITMAP_SET(bm);
-    }
-
-    for (int bm = 0; bm < IRQ_NUM_ISA; bm++)
-        HW_BITMAP_SET(bm);
+    BitmapSetRange(&kIrqSwBitmap, IRQ_NUM_VECTORS - IRQ_VECTOR_BASE, IRQ_NUM_VECTORS);
+    BitmapSetRange(&kIrqHwBitmap, IRQ_NUM_VECTORS - IRQ_VECTOR_BASE, IRQ_NUM_VECTORS);
+    BitmapSetRange(&kIrqHwBitmap, 0, IRQ_NUM_ISA);
 
     // Mask out all but the highest IRQ
-    for (int bm = kApicHighestIrq + 1; bm < IRQ_NUM_VECTORS - IRQ_VECTOR_BASE + 1; bm++)
-        HW_BITMAP_SET(bm);
+    BitmapSetRange(&kIrqHwBitmap, kApicHighestIrq + 1, IRQ_NUM_VECTORS - IRQ_VECTOR_BASE + 1);
 
     for (int irq = 0; irq < IRQ_NUM_ISA; irq++) {
         if (kIrqIsaOverrides[irq].used) {
@@ -105,7 +100,7 @@ void ApicInitializeInterrupts(void) {
     }
 
     kIpiVector = IRQ_NUM_VECTORS - 1;
-    SW_BITMAP_SET(kIpiVector - IRQ_VECTOR_BASE);
+    BitmapSet(&kIrqSwBitmap, kIpiVector - IRQ_VECTOR_BASE);
 
     ApicEnableInterrupt(kIpiVector);
 }
@@ -153,14 +148,11 @@ static uint8_t ApicIrqMapToVector(uint8_t irq) {
 }
 
 int ApicAllocateSoftwareIrq() {
-    for (int bm = 0; bm < IRQ_NUM_VECTORS; bm++) {
-        if (!SW_BITMAP_GET(bm)) {
-            SW_BITMAP_SET(bm);
-            return bm + kApicHighestIrq + 1;
-        }
-    }
+    int64_t bm = BitmapAllocateAtomic(&kIrqSwBitmap);
+    if (bm < 0)
+        return -1;
 
-    return -1;
+    return bm + kApicHighestIrq + 1;
 }
 
 void ApicRegisterIrqHandler(uint8_t irq, IrqHandlerFn handler, void *data) {
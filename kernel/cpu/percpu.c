@@ -0,0 +1,21 @@
+#include "percpu.h"
+#include "intel.h"
+
+#include <utl/serial.h>
+
+#define MSR_GS_BASE 0xC0000101
+
+static CpuLocal kCpuLocals[CPU_MAX];
+
+void CpuInitializeLocal(uint32_t id) {
+    if (id >= CPU_MAX) {
+        ComPrint("[CPU] Core %d is above the supported maximum of %d!\n", id, CPU_MAX);
+        return;
+    }
+
+    CpuLocal *local = &kCpuLocals[id];
+    local->self = local;
+    local->id = id;
+
+    IntelWriteMsr(MSR_GS_BASE, (uint64_t) local);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CPU_MAX 32
+
+// Every core points its GS base at its own CpuLocal, so the fields can be read with a single gs-relative load.
+typedef struct CpuLocal {
+    struct CpuLocal *self;
+    uint32_t id;
+} CpuLocal;
+
+void CpuInitializeLocal(uint32_t id);
+
+#ifdef HOST_BUILD
+// The host build is a single thread that poses as the boot core.
+static inline uint32_t CpuGetId(void) {
+    return 0;
+}
+#else
+static inline CpuLocal *CpuGetLocal(void) {
+    CpuLocal *local;
+    __asm__ volatile("movq %%gs:%c1, %0"
+                     : "=r"(local)
+                     : "i"(offsetof(CpuLocal, self)));
+    return local;
+}
+
+static inline uint32_t CpuGetId(void) {
+    uint32_t id;
+    __asm__ volatile("movl %%gs:%c1, %0"
+                     : "=r"(id)
+                     : "i"(offsetof(CpuLocal, id)));
+    return id;
+}
+#endif
@@ -1,6 +1,7 @@
 #include "pci.h"
 
 #include <cpu/intel.h>
+#include <mem/vma.h>
 #include <utl/serial.h>
 
 #include "gpu/cherrytrail.h"
@@ -188,28 +189,63 @@ void PciInitialize(AcpiMcfg *mcfg) {
     }
 }
 
+// Writes all ones to a BAR register and returns which address bits stuck, restoring the original value.
+static uint32_t PciProbeBar(PciDevice *device, uint8_t offset, uint32_t value) {
+    PciWrite32(device, offset, 0xFFFFFFFF);
+    uint32_t mask = PciRead32(device, offset);
+    PciWrite32(device, offset, value);
+    return mask;
+}
+
 void PciReadBar(PciDevice *device, uint8_t bar, PciBar *out) {
-    uint64_t bar_base = PciRead32(device, 0x10 + bar * 4);
-    if (bar_base & kPciBar64) {
-        bar_base |= PciRead32(device, 0x10 + bar * 4 + 4) << 32;
-        bar_base &= ~0xF;
+    uint8_t offset = 0x10 + bar * 4;
+    uint32_t bar_low = PciRead32(device, offset);
 
-        out->base = bar_base;
-        out->type = kPciBarTypeMemory;
-        out->size = 0;
+    // Decoding has to be off while the BAR is being sized, otherwise it briefly claims random addresses.
+    uint16_t command = PciRead16(device, 4);
+    PciWrite16(device, 4, command & ~0x3);
 
-        return;
-    }
+    uint32_t mask_low = PciProbeBar(device, offset, bar_low);
 
-    if (bar_base & kPciBarIo) {
-        bar_base &= ~0x3;
+    if (bar_low & kPciBarIo) {
+        uint32_t mask = mask_low & ~0x3;
+        if (!(mask & 0xFFFF0000))
+            mask |= 0xFFFF0000;
 
-        out->base = bar_base;
+        out->base = bar_low & ~0x3;
+        out->size = mask_low ? (uint32_t) (~mask + 1) : 0;
+        out->flags = kPciBarIo;
         out->type = kPciBarTypeIo;
-        out->size = 0;
+    } else {
+        uint64_t base = bar_low & ~0xF;
+        uint64_t mask = (mask_low & ~0xF) | 0xFFFFFFFF00000000;
+        uint64_t decoded = mask_low & ~0xF;
+
+        if (bar_low & kPciBar64) {
+            uint32_t bar_high = PciRead32(device, offset + 4);
+            uint32_t mask_high = PciProbeBar(device, offset + 4, bar_high);
+
+            base |= (uint64_t) bar_high << 32;
+            mask = ((uint64_t) mask_high << 32) | (mask_low & ~0xF);
+            decoded = mask;
+        }
 
-        return;
+        out->base = base;
+        out->size = decoded ? ~mask + 1 : 0;
+        out->flags = bar_low & 0xF;
+        out->type = kPciBarTypeMemory;
     }
+
+    PciWrite16(device, 4, command);
+}
+
+void *PciMapBar(PciBar *bar) {
+    if (bar->type != kPciBarTypeMemory)
+        return 0;
+
+    // Prefetchable BARs have no read side effects, so writes to them may be combined.
+    uint8_t type = (bar->flags & kPciBarPrefetch) ? MM_MEMORY_WC : MM_MEMORY_UC;
+    return ioremap(bar->base, bar->size ? bar->size : PAGE_SIZE, type);
 }
 
 void PciMaybeEnableBusMastering(PciDevice *device) {
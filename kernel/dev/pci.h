@@ -62,6 +62,7 @@ void PciWrite32(PciDevice *device, uint8_t offset, uint32_t value);
 void PciInitialize(AcpiMcfg *mcfg);
 
 void PciReadBar(PciDevice *device, uint8_t bar, PciBar *out);
+void *PciMapBar(PciBar *bar);
 
 void PciMaybeEnableBusMastering(PciDevice *device);
 void PciMaybeEnableMemoryAccess(PciDevice *device);
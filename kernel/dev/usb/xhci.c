@@ -1,5 +1,9 @@
 #include "xhci.h"
 
+#include <lib/memory.h>
+#include <mem/dma.h>
+#include <mem/heap.h>
+#include <mem/slab.h>
 #include <mem/vmm.h>
 #include <utl/serial.h>
 
@@ -21,6 +25,9 @@ typedef volatile struct {
     uint32_t : 31;
 } XhciMsixEntry;
 
+static KmCache *kXhciRingCache = 0;
+static KmCache *kXhciInterrupterCache = 0;
+
 static void XhciHostIrq(uint8_t irq, void *data);
 
 static uint8_t XhciTryProbe(PciDevice *device) {
@@ -35,12 +42,14 @@ static void XhciInitialize(PciDriver *driver) {
     PciMaybeEnableBusMastering(&driver->device);
     PciMaybeEnableMemoryAccess(&driver->device);
 
-    uint64_t mmio_base = PciRead32(&driver->device, 0x10);
-    if (mmio_base & kPciBar64)
-        mmio_base |= (uint64_t) PciRead32(&driver->device, 0x14) << 32;
-    mmio_base &= ~0xF;
+    if (!kXhciRingCache) {
+        kXhciRingCache = KmCacheCreate("XhciRing", sizeof(XhciRing), KM_CACHE_LINE, 0);
+        kXhciInterrupterCache = KmCacheCreate("XhciInterrupter", sizeof(XhciInterrupter), KM_CACHE_LINE, 0);
+    }
 
-    MmMapMemory((void *) mmio_base, (void *) mmio_base);
+    PciBar bar;
+    PciReadBar(&driver->device, 0, &bar);
+    uint64_t mmio_base = (uint64_t) PciMapBar(&bar);
 
     XhciDevice *xhci = driver->data = (XhciDevice *) kmalloc(sizeof(XhciDevice));
 
@@ -67,9 +76,8 @@ static void XhciInitialize(PciDriver *driver) {
     // Enable every slot.
     xhci->op->config = xhci->cap->hcc_params1 & 0xFF;
 
-    // Set up the device context base address array pointer.
-    uint64_t dcbaap = kmalloc((xhci->cap->hcs_params1 & 0xFF) * sizeof(uint64_t));
-    xhci->dcbaap = MmGetPhysicalAddress((void *) dcbaap);
+    // Set up the device context base address array pointer. 255 slots always fit into a single page.
+    xhci->dcbaa = (uint64_t *) DmaAlloc(XHCI_DCBAA_SIZE, 64, PAGE_SIZE, &xhci->dcbaap);
 
     xhci->op->dcbaap_low = xhci->dcbaap;
     xhci->op->dcbaap_high = xhci->dcbaap >> 32;
@@ -77,10 +85,10 @@ static void XhciInitialize(PciDriver *driver) {
     // Set up the command ring.
     xhci->cmd = XhciRingCreate(CMD_RING_SIZE);
 
-    xhci->interrupter_bitmap_size = (xhci->cap->hcs_params1 >> 8) & 0x7FF;
-    ComPrint("[XHCI] Interrupter bitmap size: %d\n", xhci->interrupter_bitmap_size);
-    xhci->interrupter_bitmap = (uint8_t *) kmalloc(xhci->interrupter_bitmap_size / 8);
-    RtZeroMemory(xhci->interrupter_bitmap, xhci->interrupter_bitmap_size / 8);
+    uint64_t interrupters = (xhci->cap->hcs_params1 >> 8) & 0x7FF;
+    ComPrint("[XHCI] Interrupter bitmap size: %D\n", interrupters);
+    BitmapInitialize(&xhci->interrupters, (uint64_t *) kmalloc(BITMAP_WORDS(interrupters) * sizeof(uint64_t)),
+                     interrupters);
 
     xhci->interrupter = XhciInterrupterCreate(xhci, XhciHostIrq, xhci);
 }
@@ -92,23 +100,24 @@ static void XhciFinalize(PciDriver *driver) {
 }
 
 XhciRing *XhciRingCreate(uint64_t size) {
-    uint32_t num_pages = ((size * sizeof(XhciTrb)) + 0xFFF) / PAGE_SIZE;
-    uint32_t num_trbs = num_pages * PAGE_SIZE / sizeof(XhciTrb);
+    XhciRing *ring = (XhciRing *) KmCacheAlloc(kXhciRingCache);
+    RtZeroMemory((void *) ring, sizeof(XhciRing));
 
-    XhciRing *ring = (XhciRing *) kmalloc(sizeof(XhciRing));
-    RtZeroMemory(ring, sizeof(XhciRing));
+    // Ring segments are 64 byte aligned and may not cross a 64 KiB boundary.
+    uint64_t phys = 0;
+    ring->ptr = (XhciTrb *) DmaAlloc(size * sizeof(XhciTrb), 64, 0x10000, &phys);
+    ring->phys = phys;
 
-    ring->ptr = kmalloc(size * sizeof(XhciTrb));
     ring->index = 0;
-    ring->max_index = num_trbs;
+    ring->max_index = size;
     ring->cycle = 1;
 
     return ring;
 }
 
 void XhciRingDestroy(XhciRing *ring) {
-    kfree(ring->ptr);
-    kfree(ring);
+    DmaFree((void *) ring->ptr, ring->max_index * sizeof(XhciTrb), 64);
+    KmCacheFree(kXhciRingCache, (void *) ring);
 }
 
 int XhciRingAdd(XhciRing *ring, XhciTrb *trb) {
@@ -124,7 +133,7 @@ int XhciRingAdd(XhciRing *ring, XhciTrb *trb) {
         link.trb_type = kTrbLink;
         link.cycle = ring->cycle;
         link.toggle_cycle = 1;
-        link.rs_addr = MmGetPhysicalAddress((void *) ring->ptr);
+        link.rs_addr = ring->phys;
 
         ring->ptr[ring->index] = *(XhciTrb *) &link;
         ring->index = 0;
@@ -154,7 +163,7 @@ int XhciRingGet(XhciRing *ring, XhciTrb *trb) {
 }
 
 uint64_t XhciRingGetPhysicalAddress(XhciRing *ring) {
-    return MmGetPhysicalAddress(ring->ptr) + (ring->index * sizeof(XhciTrb));
+    return ring->phys + (ring->index * sizeof(XhciTrb));
 }
 
 uint64_t XhciRingSize(XhciRing *ring) {
@@ -163,23 +172,16 @@ uint64_t XhciRingSize(XhciRing *ring) {
 
 XhciInterrupter *XhciInterrupterCreate(XhciDevice *xhci, IrqHandlerFn handler, void *data) {
     // Find a free interrupter.
-    int interrupter_index = -1;
-    for (int i = 0; i < xhci->interrupter_bitmap_size; i++) {
-        if (!INTERRUPTER_BITMAP_GET(xhci, i)) {
-            interrupter_index = i;
-            break;
-        }
-    }
-
+    int64_t interrupter_index = BitmapAllocateAtomic(&xhci->interrupters);
     if (interrupter_index == -1)
         return 0;
 
-    INTERRUPTER_BITMAP_SET(xhci, interrupter_index);
-
     int irq = ApicAllocateSoftwareIrq();
-    ComPrint("[XHCI] Allocated IRQ %d for interrupter %d\n", irq, interrupter_index);
-    if (irq == -1)
+    ComPrint("[XHCI] Allocated IRQ %d for interrupter %D\n", irq, interrupter_index);
+    if (irq == -1) {
+        BitmapClearAtomic(&xhci->interrupters, interrupter_index);
         return 0;
+    }
 
     ApicRegisterIrqHandler(irq, handler, data);
     ApicEnableInterrupt(irq);
@@ -224,18 +226,20 @@ XhciInterrupter *XhciInterrupterCreate(XhciDevice *xhci, IrqHandlerFn handler, v
     entry->masked = 0;
 
 
-    XhciErstEntry *erst = (XhciErstEntry *) kmalloc(ERST_SIZE * sizeof(XhciErstEntry));
+    uint64_t erst_address = 0;
+    XhciErstEntry *erst = (XhciErstEntry *) DmaAlloc(ERST_SIZE * sizeof(XhciErstEntry), 64, 0, &erst_address);
     XhciRing *ring = XhciRingCreate(EVT_RING_SIZE);
 
     erst->rs_addr = XhciRingGetPhysicalAddress(ring);
     erst->rs_size = XhciRingSize(ring);
 
-    XhciInterrupter *interrupter = (XhciInterrupter *) kmalloc(sizeof(XhciInterrupter));
+    XhciInterrupter *interrupter = (XhciInterrupter *) KmCacheAlloc(kXhciInterrupterCache);
 
     interrupter->index = interrupter_index;
     interrupter->vector = irq;
     interrupter->ring = ring;
     interrupter->erst = erst;
+    interrupter->erst_phys = erst_address;
 
     return interrupter;
 }
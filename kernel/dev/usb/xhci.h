@@ -4,6 +4,7 @@
 
 #include <cpu/apic.h>
 #include <dev/pci.h>
+#include <lib/bitmap.h>
 
 typedef volatile struct __attribute__((packed)) {
     uint8_t length;
@@ -157,6 +158,7 @@ typedef struct {
 
 typedef volatile struct {
     XhciTrb *ptr;
+    uint64_t phys;
     uint32_t index;
     uint32_t max_index;
     int cycle;
@@ -173,6 +175,7 @@ typedef struct {
     uint8_t index;
     uint8_t vector;
     XhciErstEntry *erst;
+    uint64_t erst_phys;
     XhciRing *ring;
 } XhciInterrupter;
 
@@ -181,10 +184,7 @@ typedef struct {
 #define EVT_RING_SIZE 256
 #define XFER_RING_SIZE 256
 #define ERST_SIZE 1
-
-#define INTERRUPT_BM_GET(dev, i) (dev->interrupt_bitmap[i / 8] & (1 << (i % 8)))
-#define INTERRUPT_BM_SET(dev, i) (dev->interrupt_bitmap[i / 8] |= (1 << (i % 8)))
-#define INTERRUPT_BM_CLR(dev, i) (dev->interrupt_bitmap[i / 8] &= ~(1 << (i % 8)))
+#define XHCI_DCBAA_SIZE (256 * sizeof(uint64_t))
 
 typedef struct {
     PciDevice *pci;
@@ -194,10 +194,10 @@ typedef struct {
     XhciRuntimeRegisters *volatile rt;
     XhciDoorbellRegister *volatile db;
     void *volatile xcap;
+    uint64_t *dcbaa;
     uint64_t dcbaap;
 
-    uint64_t interrupter_bitmap_size;
-    uint8_t *interrupter_bitmap;
+    Bitmap interrupters;
 
     XhciInterrupter *interrupter;
 
@@ -205,9 +205,6 @@ typedef struct {
     XhciRing *evt;
 } XhciDevice;
 
-#define INTERRUPTER_BITMAP_GET(dev, i) (dev->interrupter_bitmap[i / 8] & (1 << (i % 8)))
-#define INTERRUPTER_BITMAP_SET(dev, i) (dev->interrupter_bitmap[i / 8] |= (1 << (i % 8)))
-
 XhciRing *XhciRingCreate(uint64_t size);
 void XhciRingDestroy(XhciRing *ring);
 
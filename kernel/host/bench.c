@@ -0,0 +1,173 @@
+#include "mock.h"
+
+#include <lib/memory.h>
+#include <mem/buddy.h>
+#include <mem/heap.h>
+#include <mem/pmm.h>
+
+#include <stdio.h>
+
+#define HOST_BENCH_PAIRS 1000000
+#define HOST_BENCH_BATCH 1024
+#define HOST_BENCH_ROUNDS 1000
+#define HOST_BENCH_COPY_BYTES (1ull << 30)
+
+static void *volatile kHostSink;
+
+static void HostReport(const char *name, uint64_t operations, uint64_t nanoseconds) {
+    printf("bench %-28s %10.1f ns/op %12.0f ops/s\n", name, (double) nanoseconds / operations,
+           operations * 1e9 / (nanoseconds ? nanoseconds : 1));
+}
+
+static void HostBenchKmalloc(uint32_t size) {
+    char name[64];
+    static void *batch[HOST_BENCH_BATCH];
+
+    uint64_t start = HostGetTime();
+    for (uint64_t i = 0; i < HOST_BENCH_PAIRS; i++) {
+        void *object = kmalloc(size);
+        kHostSink = object;
+        kfree(object);
+    }
+    snprintf(name, sizeof(name), "kmalloc/kfree %u", size);
+    HostReport(name, HOST_BENCH_PAIRS, HostGetTime() - start);
+
+    // Batches keep many objects live at once, so refills and drains show up as well.
+    start = HostGetTime();
+    for (uint64_t round = 0; round < HOST_BENCH_ROUNDS; round++) {
+        for (uint64_t i = 0; i < HOST_BENCH_BATCH; i++)
+            batch[i] = kmalloc(size);
+        for (uint64_t i = 0; i < HOST_BENCH_BATCH; i++)
+            kfree(batch[i]);
+    }
+    snprintf(name, sizeof(name), "kmalloc batch %u", size);
+    HostReport(name, HOST_BENCH_ROUNDS * HOST_BENCH_BATCH, HostGetTime() - start);
+}
+
+static void HostBenchPages(void) {
+    static void *batch[HOST_BENCH_BATCH];
+
+    uint64_t start = HostGetTime();
+    for (uint64_t i = 0; i < HOST_BENCH_PAIRS; i++) {
+        void *page = MmRequestPage();
+        kHostSink = page;
+        MmFreePage(page);
+    }
+    HostReport("page alloc/free", HOST_BENCH_PAIRS, HostGetTime() - start);
+
+    start = HostGetTime();
+    for (uint64_t round = 0; round < HOST_BENCH_ROUNDS / 10; round++) {
+        for (uint64_t i = 0; i < HOST_BENCH_BATCH; i++)
+            batch[i] = MmRequestPage();
+        for (uint64_t i = 0; i < HOST_BENCH_BATCH; i++)
+            MmFreePage(batch[i]);
+    }
+    HostReport("page batch", HOST_BENCH_ROUNDS / 10 * HOST_BENCH_BATCH, HostGetTime() - start);
+
+    for (uint64_t order = 1; order <= 4; order++) {
+        char name[64];
+        start = HostGetTime();
+        for (uint64_t i = 0; i < HOST_BENCH_PAIRS / 10; i++) {
+            void *block = MmRequestPages(order);
+            kHostSink = block;
+            MmFreePages(block, order);
+        }
+        snprintf(name, sizeof(name), "buddy order %llu", (unsigned long long) order);
+        HostReport(name, HOST_BENCH_PAIRS / 10, HostGetTime() - start);
+    }
+}
+
+// The byte loops the primitives used to be, kept as the baseline. Vectorizing them would flatter the comparison.
+#define HOST_BASELINE __attribute__((noinline, optimize("no-tree-vectorize", "no-tree-loop-distribute-patterns")))
+
+static HOST_BASELINE void HostByteCopy(void *destination, const void *source, uint64_t size) {
+    uint8_t *to = (uint8_t *) destination;
+    const uint8_t *from = (const uint8_t *) source;
+    for (uint64_t i = 0; i < size; i++)
+        to[i] = from[i];
+}
+
+static HOST_BASELINE void HostByteFill(void *address, uint64_t size, uint8_t value) {
+    uint8_t *to = (uint8_t *) address;
+    for (uint64_t i = 0; i < size; i++)
+        to[i] = value;
+}
+
+static HOST_BASELINE int HostByteCompare(const void *a, const void *b, uint64_t size) {
+    const uint8_t *left = (const uint8_t *) a, *right = (const uint8_t *) b;
+    for (uint64_t i = 0; i < size; i++) {
+        if (left[i] != right[i])
+            return left[i] - right[i];
+    }
+    return 0;
+}
+
+typedef enum HostPrimitive {
+    kHostCopy,
+    kHostMove,
+    kHostFill,
+    kHostCompare,
+} HostPrimitive;
+
+static uint64_t HostTimePrimitive(HostPrimitive primitive, uint8_t baseline, uint8_t *a, uint8_t *b, uint64_t size,
+                                  uint64_t rounds) {
+    volatile int sink = 0;
+    uint64_t start = HostGetTime();
+    for (uint64_t round = 0; round < rounds; round++) {
+        switch (primitive) {
+            case kHostCopy:
+                baseline ? HostByteCopy(a, b, size) : RtCopyMemory(a, b, size);
+                break;
+            case kHostMove:
+                // Overlapping by one byte with the destination behind the source, the case memmove used to get wrong.
+                baseline ? HostByteCopy(a, a + 1, size) : RtMoveMemory(a + 1, a, size);
+                break;
+            case kHostFill:
+                baseline ? HostByteFill(a, size, (uint8_t) round) : RtFillMemory(a, size, (uint8_t) round);
+                break;
+            case kHostCompare:
+                sink += baseline ? HostByteCompare(a, b, size) : RtCompareMemory(a, b, size);
+                break;
+        }
+    }
+    (void) sink;
+    return HostGetTime() - start;
+}
+
+static void HostBenchMemory(void) {
+    static const char *names[] = {"copy", "move", "fill", "compare"};
+    uint8_t *a = kmalloc((1 << 20) + 64);
+    uint8_t *b = kmalloc((1 << 20) + 64);
+    RtFillMemory(b, 1 << 20, 0x5A);
+
+    printf("bench memory features:%s%s\n", RtGetMemoryFeatures() & RT_MEMORY_ERMS ? " erms" : "",
+           RtGetMemoryFeatures() & RT_MEMORY_FSRM ? " fsrm" : "");
+
+    // Compare runs over equal buffers, so both variants walk the whole range.
+    for (uint64_t primitive = kHostCopy; primitive <= kHostCompare; primitive++) {
+        RtFillMemory(a, 1 << 20, 0x5A);
+        for (uint64_t size = 8; size <= (1 << 20); size <<= 2) {
+            uint64_t rounds = HOST_BENCH_COPY_BYTES / 16 / size;
+            uint64_t baseline = HostTimePrimitive(primitive, 1, a, b, size, rounds);
+            uint64_t current = HostTimePrimitive(primitive, 0, a, b, size, rounds);
+
+            printf("bench %-8s %8llu bytes %10.1f ns/op %10.1f MiB/s (byte loop %10.1f MiB/s, %5.1fx)\n",
+                   names[primitive], (unsigned long long) size, (double) current / rounds,
+                   rounds * size * 1e9 / (current ? current : 1) / (1 << 20),
+                   rounds * size * 1e9 / (baseline ? baseline : 1) / (1 << 20),
+                   (double) baseline / (current ? current : 1));
+        }
+    }
+
+    kfree(a);
+    kfree(b);
+}
+
+void HostRunBenchmarks(void) {
+    static const uint32_t sizes[] = {16, 64, 256, 1024, 4096};
+    for (uint64_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        HostBenchKmalloc(sizes[i]);
+
+    HostBenchPages();
+    HostBenchMemory();
+}
@@ -0,0 +1,22 @@
+#include "mock.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Runs the allocator tests against the mocked machine, then the benchmarks unless a test failed.
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v"))
+            kHostVerbose = 1;
+    }
+
+    HostInitialize();
+
+    if (!HostRunTests()) {
+        fprintf(stderr, "host: tests failed\n");
+        return 1;
+    }
+
+    HostRunBenchmarks();
+    return 0;
+}
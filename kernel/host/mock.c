@@ -0,0 +1,174 @@
+#include "mock.h"
+
+#include <limine.h>
+#include <lib/memory.h>
+#include <mem/buddy.h>
+#include <mem/heap.h>
+#include <mem/pmm.h>
+#include <mem/vma.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+uint8_t kHostVerbose = 0;
+
+static struct limine_memmap_entry kHostEntries[HOST_MEMORY_REGIONS * 2];
+static struct limine_memmap_entry *kHostEntryPointers[HOST_MEMORY_REGIONS * 2];
+static struct limine_memmap_response kHostMemoryMap;
+
+// Areas handed out by the mocked MmAllocateVirtual, the heap is the only user.
+#define HOST_VMA_AREAS 8
+static MmVma kHostAreas[HOST_VMA_AREAS];
+
+// Reserves address space without committing it, the kernel's lazy regions behave the same.
+static void *HostReserve(uint64_t size, uint64_t alignment) {
+    uint8_t *base = mmap(0, size + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                         -1, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    return (void *) (((uint64_t) base + alignment - 1) & ~(alignment - 1));
+}
+
+void HostInitialize(void) {
+    RtInitializeMemory();
+
+    // Physical addresses are the process' own addresses, aligned so the largest buddy blocks line up.
+    uint64_t alignment = PAGE_SIZE << MM_BUDDY_MAX_ORDER;
+    uint64_t base = (uint64_t) HostReserve(HOST_MEMORY_SIZE, alignment);
+    kHhdmOffset = 0;
+
+    // Every region is followed by a reserved hole of a few pages, like the firmware ranges on real machines.
+    uint64_t region = HOST_MEMORY_SIZE / HOST_MEMORY_REGIONS;
+    for (uint64_t i = 0; i < HOST_MEMORY_REGIONS; i++) {
+        struct limine_memmap_entry *usable = &kHostEntries[i * 2];
+        usable->base = base + i * region;
+        usable->length = region - 16 * PAGE_SIZE;
+        usable->type = LIMINE_MEMMAP_USABLE;
+
+        struct limine_memmap_entry *reserved = &kHostEntries[i * 2 + 1];
+        reserved->base = usable->base + usable->length;
+        reserved->length = 16 * PAGE_SIZE;
+        reserved->type = LIMINE_MEMMAP_RESERVED;
+
+        kHostEntryPointers[i * 2] = usable;
+        kHostEntryPointers[i * 2 + 1] = reserved;
+    }
+
+    kHostMemoryMap.entry_count = HOST_MEMORY_REGIONS * 2;
+    kHostMemoryMap.entries = kHostEntryPointers;
+
+    if (!MmInitializeMemoryMap(&kHostMemoryMap)) {
+        fprintf(stderr, "host: the PMM rejected the memory map\n");
+        exit(1);
+    }
+
+    MmInitializeBuddy();
+    MmInitializeHeap();
+}
+
+uint64_t HostGetTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void HostReportFailure(const char *file, int line, const char *condition) {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+}
+
+void ComPutChar(char c) {
+    if (kHostVerbose)
+        putchar(c);
+}
+
+// Understands the same conversions as the serial driver: %s %c %d %D %x %X and %%.
+void ComPrint(const char *fmt, ...) {
+    if (!kHostVerbose)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            putchar(*fmt);
+            continue;
+        }
+
+        switch (*++fmt) {
+            case 's':
+                fputs(va_arg(args, const char *), stdout);
+                break;
+            case 'c':
+                putchar(va_arg(args, int));
+                break;
+            case 'd':
+                printf("%d", va_arg(args, int));
+                break;
+            case 'D':
+                printf("%llu", (unsigned long long) va_arg(args, uint64_t));
+                break;
+            case 'x':
+                printf("%x", va_arg(args, unsigned int));
+                break;
+            case 'X':
+                printf("%llX", (unsigned long long) va_arg(args, uint64_t));
+                break;
+            case '%':
+                putchar('%');
+                break;
+            default:
+                fmt--;
+                break;
+        }
+    }
+
+    va_end(args);
+}
+
+MmVma *MmAllocateVirtual(uint64_t size, uint64_t alignment, uint64_t flags) {
+    for (uint64_t i = 0; i < HOST_VMA_AREAS; i++) {
+        MmVma *area = &kHostAreas[i];
+        if (area->start)
+            continue;
+
+        area->start = (uint64_t) HostReserve(size, alignment < PAGE_SIZE ? PAGE_SIZE : alignment);
+        area->end = area->start + size;
+        area->flags = flags;
+        return area;
+    }
+
+    return 0;
+}
+
+void MmFreeVirtual(MmVma *area) {
+    munmap((void *) area->start, area->end - area->start);
+    area->start = 0;
+}
+
+int MmRegisterLazyRegion(void *address, uint64_t size) {
+    (void) address;
+    (void) size;
+    return 1;
+}
+
+// Dropping the pages gives them back to the host, touching them again brings in fresh zeroed ones.
+int MmUnmapRange(void *address, uint64_t size, uint8_t free_frames) {
+    (void) free_frames;
+    madvise(address, size, MADV_DONTNEED);
+    return 0;
+}
+
+void *vmalloc(uint64_t size) {
+    return aligned_alloc(PAGE_SIZE, (size + PAGE_SIZE - 1) & ~(uint64_t) (PAGE_SIZE - 1));
+}
+
+void vfree(void *address) {
+    free(address);
+}
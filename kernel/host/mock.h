@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+// The host build replaces the bootloader, the page tables and the serial port with plain process memory, so the
+// allocators above them run unchanged as a normal program.
+
+// Size of the fake physical memory handed to the PMM, split into a few regions with holes in between.
+#define HOST_MEMORY_SIZE 0x10000000
+#define HOST_MEMORY_REGIONS 4
+
+// ComPrint output is dropped unless this is set, the allocators are chatty during setup.
+extern uint8_t kHostVerbose;
+
+void HostInitialize(void);
+uint64_t HostGetTime(void);
+
+// Test functions return 1 on success, a failed check reports itself and bails out.
+#define HOST_CHECK(condition)                                    \
+    do {                                                         \
+        if (!(condition)) {                                      \
+            HostReportFailure(__FILE__, __LINE__, #condition);   \
+            return 0;                                            \
+        }                                                        \
+    } while (0)
+
+void HostReportFailure(const char *file, int line, const char *condition);
+
+uint8_t HostRunTests(void);
+void HostRunBenchmarks(void);
@@ -0,0 +1,604 @@
+#include "mock.h"
+
+#include <cpu/apic.h>
+#include <lib/array.h>
+#include <lib/bitmap.h>
+#include <lib/memory.h>
+#include <lib/rbtree.h>
+#include <mem/arena.h>
+#include <mem/buddy.h>
+#include <mem/heap.h>
+#include <mem/pmm.h>
+#include <mem/slab.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define HOST_TEST_PAGES 2048
+#define HOST_TEST_SLOTS 1024
+#define HOST_TEST_OPERATIONS 200000
+
+static uint64_t kHostSeed = 1;
+
+static uint64_t HostRandom(void) {
+    kHostSeed = kHostSeed * 6364136223846793005ull + 1442695040888963407ull;
+    return kHostSeed >> 33;
+}
+
+// Every live block is filled with a byte derived from its slot, so overlapping blocks show up as corruption.
+static uint8_t HostCheckPattern(uint8_t *block, uint64_t size, uint8_t pattern) {
+    for (uint64_t i = 0; i < size; i++) {
+        if (block[i] != pattern)
+            return 0;
+    }
+    return 1;
+}
+
+static uint8_t HostTestPmm(void) {
+    static void *pages[HOST_TEST_PAGES];
+
+    for (uint64_t i = 0; i < HOST_TEST_PAGES; i++) {
+        pages[i] = MmRequestPage();
+        HOST_CHECK(pages[i] && !((uint64_t) pages[i] & (PAGE_SIZE - 1)));
+        memset(MmPhysToVirt((uint64_t) pages[i]), (uint8_t) i, PAGE_SIZE);
+    }
+
+    for (uint64_t i = 0; i < HOST_TEST_PAGES; i++)
+        HOST_CHECK(HostCheckPattern(MmPhysToVirt((uint64_t) pages[i]), PAGE_SIZE, (uint8_t) i));
+
+    // A contiguous run has to be aligned and may not overlap any page that is still handed out.
+    uint64_t run = (uint64_t) MmRequestContiguousPages(37, 16);
+    HOST_CHECK(run && !((run >> 12) & 15));
+    for (uint64_t i = 0; i < HOST_TEST_PAGES; i++)
+        HOST_CHECK((uint64_t) pages[i] < run || (uint64_t) pages[i] >= run + 37 * PAGE_SIZE);
+
+    MmUnlockPages((void *) run, 37);
+    for (uint64_t i = 0; i < HOST_TEST_PAGES; i++)
+        MmFreePage(pages[i]);
+
+    return 1;
+}
+
+static uint8_t HostTestBuddy(void) {
+    void *blocks[MM_BUDDY_MAX_ORDER + 1];
+
+    for (uint64_t order = 0; order <= MM_BUDDY_MAX_ORDER; order++) {
+        blocks[order] = MmRequestPages(order);
+        HOST_CHECK(blocks[order] && !((uint64_t) blocks[order] & ((PAGE_SIZE << order) - 1)));
+        memset(MmPhysToVirt((uint64_t) blocks[order]), (uint8_t) order, PAGE_SIZE << order);
+    }
+
+    for (uint64_t order = 0; order <= MM_BUDDY_MAX_ORDER; order++) {
+        HOST_CHECK(HostCheckPattern(MmPhysToVirt((uint64_t) blocks[order]), PAGE_SIZE << order, (uint8_t) order));
+        MmFreePages(blocks[order], order);
+    }
+
+    return 1;
+}
+
+// Once the bitmap is empty MmRequestPage has to reach the blocks the buddy allocator split. It puts all of them
+// back into the bitmap instead of taking a single page, which MmFreePage would return to the bitmap and strand the
+// rest of the block in the buddy lists.
+static uint8_t HostTestReclaim(void) {
+    static void *bitmap[HOST_MEMORY_SIZE / PAGE_SIZE];
+    static void *cached[HOST_MEMORY_SIZE / PAGE_SIZE];
+
+    void *block = MmRequestPages(0);
+    uint64_t split = kBuddy.cached_pages;
+    HOST_CHECK(block && split);
+
+    uint64_t taken = 0;
+    while ((bitmap[taken] = MmRequestContiguousPages(1, 1)))
+        taken++;
+
+    // Whatever the per-CPU cache still holds comes first.
+    uint64_t requested = 0;
+    while (kBuddy.cached_pages == split) {
+        cached[requested] = MmRequestPage();
+        HOST_CHECK(cached[requested]);
+        requested++;
+    }
+    HOST_CHECK(!kBuddy.cached_pages);
+
+    for (uint64_t i = 0; i < taken; i++)
+        MmUnlockPage(bitmap[i]);
+    for (uint64_t i = 0; i < requested; i++)
+        MmFreePage(cached[i]);
+    MmFreePages(block, 0);
+    MmReclaimBuddyPages();
+
+    return 1;
+}
+
+static uint8_t HostTestHeap(void) {
+    static uint8_t *slots[HOST_TEST_SLOTS];
+    static uint64_t sizes[HOST_TEST_SLOTS];
+
+    HeapStatistics before;
+    HeapGetStatistics(kHeap, &before);
+
+    for (uint64_t operation = 0; operation < HOST_TEST_OPERATIONS; operation++) {
+        uint64_t random = HostRandom();
+        uint64_t slot = random % HOST_TEST_SLOTS;
+        uint8_t pattern = (uint8_t) slot;
+
+        if (!slots[slot]) {
+            sizes[slot] = 1 + (random >> 10) % ((random >> 30) & 1 ? 256 : 16384);
+            slots[slot] = HeapAllocate(kHeap, sizes[slot], (random >> 24) % 64 == 0);
+            HOST_CHECK(slots[slot] && !((uint64_t) slots[slot] & (HEAP_ALIGN - 1)));
+            memset(slots[slot], pattern, sizes[slot]);
+            continue;
+        }
+
+        HOST_CHECK(HostCheckPattern(slots[slot], sizes[slot], pattern));
+
+        uint64_t size = 1 + (random >> 10) % 8192;
+        if ((random >> 20) % 4 == 0 && HeapResize(kHeap, slots[slot], size)) {
+            if (size > sizes[slot])
+                memset(slots[slot] + sizes[slot], pattern, size - sizes[slot]);
+            sizes[slot] = size;
+            continue;
+        }
+
+        HeapFree(kHeap, slots[slot]);
+        slots[slot] = 0;
+    }
+
+    for (uint64_t slot = 0; slot < HOST_TEST_SLOTS; slot++) {
+        if (slots[slot])
+            HOST_CHECK(HostCheckPattern(slots[slot], sizes[slot], (uint8_t) slot));
+        HeapFree(kHeap, slots[slot]);
+        slots[slot] = 0;
+    }
+
+    // Everything coalesces back into the holes the heap started with.
+    HeapStatistics after;
+    HeapGetStatistics(kHeap, &after);
+    HOST_CHECK(after.used == before.used && after.holes == before.holes);
+
+    return 1;
+}
+
+static uint8_t HostTestSlab(void) {
+    static void *objects[HOST_TEST_SLOTS];
+
+    KmCache *cache = KmCacheCreate("host-test", 72, 64, 0);
+    HOST_CHECK(cache);
+
+    for (uint64_t i = 0; i < HOST_TEST_SLOTS; i++) {
+        objects[i] = KmCacheAlloc(cache);
+        HOST_CHECK(objects[i] && !((uint64_t) objects[i] & 63));
+        memset(objects[i], (uint8_t) i, 72);
+    }
+
+    for (uint64_t i = 0; i < HOST_TEST_SLOTS; i++) {
+        HOST_CHECK(HostCheckPattern(objects[i], 72, (uint8_t) i));
+        KmCacheFree(cache, objects[i]);
+    }
+
+    KmCacheStatistics statistics;
+    KmCacheGetStatistics(cache, &statistics);
+    HOST_CHECK(statistics.in_use == 0 && statistics.allocations == HOST_TEST_SLOTS);
+
+    return 1;
+}
+
+static uint8_t HostTestKmalloc(void) {
+    static uint8_t *slots[HOST_TEST_SLOTS];
+    static uint64_t sizes[HOST_TEST_SLOTS];
+
+    for (uint64_t operation = 0; operation < HOST_TEST_OPERATIONS; operation++) {
+        uint64_t random = HostRandom();
+        uint64_t slot = random % HOST_TEST_SLOTS;
+        uint8_t pattern = (uint8_t) slot;
+        uint64_t size = 1 + (random >> 10) % ((random >> 30) & 1 ? KM_SMALL_LIMIT : 8192);
+
+        if (!slots[slot]) {
+            slots[slot] = kmalloc(size);
+            HOST_CHECK(slots[slot] && ksize(slots[slot]) >= size);
+        } else {
+            HOST_CHECK(HostCheckPattern(slots[slot], sizes[slot], pattern));
+            if ((random >> 20) & 1) {
+                kfree(slots[slot]);
+                slots[slot] = 0;
+                continue;
+            }
+
+            slots[slot] = krealloc(slots[slot], size);
+            HOST_CHECK(slots[slot] && ksize(slots[slot]) >= size);
+            HOST_CHECK(HostCheckPattern(slots[slot], size < sizes[slot] ? size : sizes[slot], pattern));
+        }
+
+        sizes[slot] = size;
+        memset(slots[slot], pattern, size);
+    }
+
+    for (uint64_t slot = 0; slot < HOST_TEST_SLOTS; slot++) {
+        kfree(slots[slot]);
+        slots[slot] = 0;
+    }
+
+    return 1;
+}
+
+static uint8_t HostTestArena(void) {
+    KmArena arena;
+    KmArenaInitialize(&arena, "host-test");
+
+    uint8_t *first = KmArenaAlloc(&arena, 100, 0);
+    HOST_CHECK(first && !((uint64_t) first & (KM_ARENA_ALIGN - 1)));
+    memset(first, 1, 100);
+
+    KmArenaMark mark = KmArenaGetMark(&arena);
+    for (uint64_t i = 0; i < HOST_TEST_SLOTS; i++) {
+        uint8_t *block = KmArenaAlloc(&arena, 1 + HostRandom() % 4096, 256);
+        HOST_CHECK(block && !((uint64_t) block & 255));
+        memset(block, 2, 1);
+    }
+
+    uint8_t *large = KmArenaAlloc(&arena, 300000, 0);
+    HOST_CHECK(large && KmArenaOwns(&arena, large));
+
+    KmArenaRelease(&arena, mark);
+    HOST_CHECK(HostCheckPattern(first, 100, 1) && arena.chunks == 1 && !KmArenaOwns(&arena, large));
+
+    // Only the latest allocation is given back, an older one stays until the arena is released.
+    KmArenaStatistics statistics;
+    uint8_t *second = KmArenaAlloc(&arena, 50, 0);
+    KmArenaFree(&arena, first);
+    KmArenaGetStatistics(&arena, &statistics);
+    HOST_CHECK(statistics.used == 112 + 50 && statistics.unreclaimed == 1);
+    HOST_CHECK(statistics.chunks == 1 && statistics.reserved == (uint64_t) PAGE_SIZE << KM_ARENA_CHUNK_ORDER);
+
+    KmArenaFree(&arena, second);
+    KmArenaGetStatistics(&arena, &statistics);
+    HOST_CHECK(statistics.used == 112 && statistics.unreclaimed == 1);
+
+    KmArenaDestroy(&arena);
+    HOST_CHECK(!arena.chunks);
+
+    return 1;
+}
+
+static int8_t HostComparePointers(void *a, void *b) {
+    return (uint64_t) a < (uint64_t) b;
+}
+
+static int HostCompareKey(void *item, void *key) {
+    return (uint64_t) item < (uint64_t) key ? -1 : (uint64_t) item > (uint64_t) key;
+}
+
+static uint8_t HostTestArray(void) {
+    static void *storage[HOST_TEST_SLOTS];
+    OrderedArray array = ArrayCreate(storage, HOST_TEST_SLOTS, HostComparePointers);
+
+    for (uint64_t i = 0; i < HOST_TEST_SLOTS; i++)
+        HOST_CHECK(ArrayInsert(&array, (void *) (HostRandom() % 100000 * 2)));
+
+    // Storage the array doesn't own can't grow.
+    HOST_CHECK(array.size == HOST_TEST_SLOTS && !ArrayInsert(&array, (void *) 1));
+    for (uint32_t i = 1; i < array.size; i++)
+        HOST_CHECK((uint64_t) ArrayGet(&array, i - 1) <= (uint64_t) ArrayGet(&array, i));
+
+    for (uint32_t i = 0; i < array.size; i++) {
+        int64_t found = ArrayFind(&array, ArrayGet(&array, i), HostCompareKey);
+        HOST_CHECK(found >= 0 && ArrayGet(&array, found) == ArrayGet(&array, i));
+        HOST_CHECK(ArrayFind(&array, (void *) ((uint64_t) ArrayGet(&array, i) + 1), HostCompareKey) < 0);
+    }
+
+    while (array.size) {
+        ArrayRemove(&array, HostRandom() % array.size);
+        for (uint32_t i = 1; i < array.size; i++)
+            HOST_CHECK((uint64_t) ArrayGet(&array, i - 1) <= (uint64_t) ArrayGet(&array, i));
+    }
+
+    OrderedArray grown = ArrayAllocate(1, HostComparePointers);
+    for (uint64_t i = 0; i < HOST_TEST_SLOTS; i++)
+        HOST_CHECK(ArrayInsert(&grown, (void *) (HOST_TEST_SLOTS - i)));
+    HOST_CHECK(grown.capacity >= HOST_TEST_SLOTS);
+    for (uint32_t i = 0; i < grown.size; i++)
+        HOST_CHECK((uint64_t) ArrayGet(&grown, i) == i + 1);
+    ArrayDestroy(&grown);
+
+    return 1;
+}
+
+// The bitmap is checked against one byte per bit, with an odd size so the last word is only partially used.
+#define HOST_TEST_BITS 1000
+
+static int64_t HostFindReference(uint8_t *bits, uint64_t first, uint64_t end, uint8_t value) {
+    for (uint64_t i = first; i < end; i++) {
+        if (bits[i] == value)
+            return (int64_t) i;
+    }
+    return -1;
+}
+
+static uint8_t HostTestBitmap(void) {
+    static uint64_t words[BITMAP_WORDS(HOST_TEST_BITS)];
+    static uint8_t reference[HOST_TEST_BITS];
+    Bitmap bitmap;
+    BitmapInitialize(&bitmap, words, HOST_TEST_BITS);
+
+    for (uint64_t operation = 0; operation < HOST_TEST_OPERATIONS / 10; operation++) {
+        uint64_t first = HostRandom() % HOST_TEST_BITS;
+        uint64_t end = first + HostRandom() % (HOST_TEST_BITS - first + 1);
+        uint8_t set = HostRandom() & 1;
+
+        uint64_t changed = 0;
+        for (uint64_t i = first; i < end; i++) {
+            changed += reference[i] != set;
+            reference[i] = set;
+        }
+        HOST_CHECK((set ? BitmapSetRange(&bitmap, first, end) : BitmapClearRange(&bitmap, first, end)) == changed);
+
+        first = HostRandom() % HOST_TEST_BITS;
+        end = first + HostRandom() % (HOST_TEST_BITS - first + 1);
+        HOST_CHECK(BitmapFindZero(&bitmap, first, end) == HostFindReference(reference, first, end, 0));
+        HOST_CHECK(BitmapFindSet(&bitmap, first, end) == HostFindReference(reference, first, end, 1));
+
+        uint64_t count = 0;
+        for (uint64_t i = first; i < end; i++)
+            count += reference[i];
+        HOST_CHECK(BitmapCount(&bitmap, first, end) == count);
+
+        // The first aligned run of clear bits, found the slow way.
+        uint64_t length = 1 + HostRandom() % 40;
+        uint64_t alignment = 1ull << (HostRandom() % 4);
+        int64_t expected = -1;
+        for (uint64_t start = 0; start + length <= HOST_TEST_BITS && expected < 0; start += alignment) {
+            if (HostFindReference(reference, start, start + length, 1) < 0)
+                expected = (int64_t) start;
+        }
+        HOST_CHECK(BitmapFindRun(&bitmap, 0, HOST_TEST_BITS, length, alignment) == expected);
+    }
+
+    for (uint64_t i = 0; i < HOST_TEST_BITS; i++)
+        HOST_CHECK(BitmapTest(&bitmap, i) == reference[i]);
+
+    // Atomic allocation hands out the lowest clear bit until the bitmap is full, never one past its end.
+    BitmapInitialize(&bitmap, words, HOST_TEST_BITS);
+    for (uint64_t i = 0; i < HOST_TEST_BITS; i++)
+        HOST_CHECK(BitmapAllocateAtomic(&bitmap) == (int64_t) i);
+    HOST_CHECK(BitmapAllocateAtomic(&bitmap) == -1);
+
+    BitmapClearAtomic(&bitmap, 700);
+    HOST_CHECK(!BitmapTestAndSetAtomic(&bitmap, 700) && BitmapTestAndSetAtomic(&bitmap, 700));
+
+    return 1;
+}
+
+// Tree nodes cache the largest value in their subtree, which exercises the augmentation through every rotation.
+typedef struct HostTreeItem {
+    uint64_t key;
+    uint64_t value;
+    uint64_t max_value;
+    uint8_t linked;
+    RbNode node;
+} HostTreeItem;
+
+static void HostTreeAugment(RbNode *node) {
+    HostTreeItem *item = RB_CONTAINER(node, HostTreeItem, node);
+    HostTreeItem *left = RB_CONTAINER(node->left, HostTreeItem, node);
+    HostTreeItem *right = RB_CONTAINER(node->right, HostTreeItem, node);
+
+    item->max_value = item->value;
+    if (left && left->max_value > item->max_value)
+        item->max_value = left->max_value;
+    if (right && right->max_value > item->max_value)
+        item->max_value = right->max_value;
+}
+
+static int HostTreeCompare(RbNode *a, RbNode *b) {
+    uint64_t x = RB_CONTAINER(a, HostTreeItem, node)->key, y = RB_CONTAINER(b, HostTreeItem, node)->key;
+    return x < y ? -1 : x > y;
+}
+
+static int HostTreeCompareKey(RbNode *node, void *key) {
+    uint64_t x = RB_CONTAINER(node, HostTreeItem, node)->key;
+    return x < (uint64_t) key ? -1 : x > (uint64_t) key;
+}
+
+// Returns the black height of the subtree, or -1 when an invariant is broken.
+static int64_t HostTreeValidate(RbNode *node, RbNode *parent, uint64_t *count) {
+    if (!node)
+        return 1;
+
+    HostTreeItem *item = RB_CONTAINER(node, HostTreeItem, node);
+    uint64_t max_value = item->value;
+    if (node->parent != parent)
+        return -1;
+    if (node->color == RB_RED && ((node->left && node->left->color == RB_RED) ||
+                                  (node->right && node->right->color == RB_RED)))
+        return -1;
+    if (node->left && HostTreeCompare(node->left, node) > 0)
+        return -1;
+    if (node->right && HostTreeCompare(node->right, node) < 0)
+        return -1;
+
+    int64_t left = HostTreeValidate(node->left, node, count);
+    int64_t right = HostTreeValidate(node->right, node, count);
+    if (left < 0 || left != right)
+        return -1;
+
+    if (node->left && RB_CONTAINER(node->left, HostTreeItem, node)->max_value > max_value)
+        max_value = RB_CONTAINER(node->left, HostTreeItem, node)->max_value;
+    if (node->right && RB_CONTAINER(node->right, HostTreeItem, node)->max_value > max_value)
+        max_value = RB_CONTAINER(node->right, HostTreeItem, node)->max_value;
+    if (item->max_value != max_value)
+        return -1;
+
+    (*count)++;
+    return left + (node->color == RB_BLACK);
+}
+
+static uint8_t HostTestRbTree(void) {
+    static HostTreeItem items[HOST_TEST_SLOTS];
+    RbTree tree = RB_TREE_INIT_AUGMENTED(HostTreeAugment);
+    uint64_t linked = 0;
+
+    for (uint64_t operation = 0; operation < HOST_TEST_OPERATIONS / 10; operation++) {
+        HostTreeItem *item = &items[HostRandom() % HOST_TEST_SLOTS];
+        if (item->linked) {
+            RB_REMOVE(&tree, item, node);
+            item->linked = 0;
+            linked--;
+        } else {
+            // Few distinct keys, so equal keys are common.
+            item->key = HostRandom() % (HOST_TEST_SLOTS / 2);
+            item->value = HostRandom();
+            RB_INSERT(&tree, item, HostTreeCompare, node);
+            item->linked = 1;
+            linked++;
+        }
+
+        // Changing an augmented input in place needs an explicit propagation.
+        if (operation % 7 == 0 && item->linked) {
+            item->value = HostRandom();
+            RbPropagate(&tree, &item->node);
+        }
+
+        if (operation % 64)
+            continue;
+
+        uint64_t count = 0;
+        HOST_CHECK(!tree.root || tree.root->color == RB_BLACK);
+        HOST_CHECK(HostTreeValidate(tree.root, 0, &count) > 0 && count == linked);
+
+        uint64_t key = HostRandom() % (HOST_TEST_SLOTS / 2);
+        HostTreeItem *bound = RB_LOWER_BOUND(&tree, (void *) key, HostTreeCompareKey, HostTreeItem, node);
+        HostTreeItem *found = RB_FIND(&tree, (void *) key, HostTreeCompareKey, HostTreeItem, node);
+        HostTreeItem *expected = 0;
+        for (uint64_t i = 0; i < HOST_TEST_SLOTS; i++) {
+            if (items[i].linked && items[i].key >= key && (!expected || items[i].key < expected->key))
+                expected = &items[i];
+        }
+        HOST_CHECK(expected ? bound && bound->key == expected->key : !bound);
+        HOST_CHECK(expected && expected->key == key ? found && found->key == key : !found);
+        HOST_CHECK(!bound || !RB_PREV(bound, HostTreeItem, node) || RB_PREV(bound, HostTreeItem, node)->key < key);
+    }
+
+    HostTreeItem *item = 0, *previous = 0;
+    uint64_t count = 0;
+    RB_FOREACH(item, &tree, HostTreeItem, node) {
+        HOST_CHECK(!previous || previous->key <= item->key);
+        HOST_CHECK(RB_PREV(item, HostTreeItem, node) == previous);
+        previous = item;
+        count++;
+    }
+    HOST_CHECK(count == linked && RB_LAST(&tree, HostTreeItem, node) == previous);
+
+    return 1;
+}
+
+typedef struct HostIoApic {
+    uint32_t gsi_base;
+    uint8_t max_rentry;
+    RbNode node;
+} HostIoApic;
+
+static int HostIoApicCompare(RbNode *a, RbNode *b) {
+    return (int) RB_CONTAINER(a, HostIoApic, node)->gsi_base - (int) RB_CONTAINER(b, HostIoApic, node)->gsi_base;
+}
+
+static int HostIoApicCompareIrq(RbNode *node, void *key) {
+    HostIoApic *ioapic = RB_CONTAINER(node, HostIoApic, node);
+    return IoApicCompareRange(ioapic->gsi_base, ioapic->max_rentry, (uint64_t) key);
+}
+
+// The last pin of an IO APIC, gsi_base + max_rentry, belongs to it. Two back to back and one after a gap.
+static uint8_t HostTestIoApic(void) {
+    static HostIoApic ioapics[] = {{24, 23, {0}}, {0, 23, {0}}, {64, 7, {0}}};
+    static const struct {
+        uint64_t irq;
+        int64_t index;
+    } lookups[] = {{0, 1}, {23, 1}, {24, 0}, {47, 0}, {48, -1}, {63, -1}, {64, 2}, {71, 2}, {72, -1}};
+
+    RbTree tree = RB_TREE_INIT;
+    for (uint64_t i = 0; i < sizeof(ioapics) / sizeof(ioapics[0]); i++)
+        RB_INSERT(&tree, &ioapics[i], HostIoApicCompare, node);
+
+    for (uint64_t i = 0; i < sizeof(lookups) / sizeof(lookups[0]); i++) {
+        HostIoApic *found = RB_FIND(&tree, (void *) lookups[i].irq, HostIoApicCompareIrq, HostIoApic, node);
+        HOST_CHECK(lookups[i].index < 0 ? !found : found == &ioapics[lookups[i].index]);
+    }
+
+    return 1;
+}
+
+static uint8_t HostTestMemory(void) {
+    static uint8_t source[8192], destination[8192], expected[8192];
+
+    for (uint64_t i = 0; i < sizeof(source); i++)
+        source[i] = (uint8_t) HostRandom();
+
+    // Odd sizes and offsets on both sides catch the head and tail handling of word-sized copies.
+    for (uint64_t round = 0; round < 2000; round++) {
+        uint64_t size = HostRandom() % 4096;
+        uint64_t from = HostRandom() % 64, to = HostRandom() % 64;
+        uint8_t value = (uint8_t) HostRandom();
+
+        memset(destination, 0xEE, sizeof(destination));
+        memset(expected, 0xEE, sizeof(expected));
+
+        RtCopyMemory(destination + to, source + from, size);
+        memcpy(expected + to, source + from, size);
+        HOST_CHECK(!memcmp(destination, expected, sizeof(expected)));
+
+        RtFillMemory(destination + to, size, value);
+        memset(expected + to, value, size);
+        HOST_CHECK(!memcmp(destination, expected, sizeof(expected)));
+
+        RtZeroMemory(destination + to, size);
+        memset(expected + to, 0, size);
+        HOST_CHECK(!memcmp(destination, expected, sizeof(expected)));
+
+        // Overlapping moves in both directions, within the same buffer.
+        memcpy(destination, source, sizeof(source));
+        memcpy(expected, source, sizeof(source));
+        RtMoveMemory(destination + to, destination + from, size);
+        memmove(expected + to, expected + from, size);
+        HOST_CHECK(!memcmp(destination, expected, sizeof(expected)));
+
+        // Comparisons only have to agree on the sign, and the first difference may sit anywhere.
+        memcpy(destination, source, sizeof(source));
+        if (size)
+            destination[from + HostRandom() % size] ^= (uint8_t) (1 + HostRandom() % 255);
+        int result = RtCompareMemory(destination + from, source + from, size);
+        int reference = memcmp(destination + from, source + from, size);
+        HOST_CHECK((result < 0) == (reference < 0) && (result > 0) == (reference > 0));
+    }
+
+    return 1;
+}
+
+typedef struct HostTest {
+    const char *name;
+    uint8_t (*run)(void);
+} HostTest;
+
+static const HostTest kHostTests[] = {
+        {"pmm", HostTestPmm},
+        {"buddy", HostTestBuddy},
+        {"reclaim", HostTestReclaim},
+        {"heap", HostTestHeap},
+        {"slab", HostTestSlab},
+        {"kmalloc", HostTestKmalloc},
+        {"arena", HostTestArena},
+        {"array", HostTestArray},
+        {"bitmap", HostTestBitmap},
+        {"rbtree", HostTestRbTree},
+        {"ioapic", HostTestIoApic},
+        {"memory", HostTestMemory},
+};
+
+uint8_t HostRunTests(void) {
+    uint8_t passed = 1;
+    for (uint64_t i = 0; i < sizeof(kHostTests) / sizeof(kHostTests[0]); i++) {
+        uint8_t result = kHostTests[i].run();
+        printf("test %-12s %s\n", kHostTests[i].name, result ? "ok" : "FAILED");
+        passed &= result;
+    }
+
+    return passed;
+}
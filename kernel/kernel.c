@@ -6,13 +6,21 @@
 #include <cpu/acpi.h>
 #include <cpu/apic.h>
 #include <cpu/intel.h>
+#include <cpu/percpu.h>
 
+#include <lib/memory.h>
+
+#include <mem/buddy.h>
+#include <mem/dma.h>
 #include <mem/heap.h>
 #include <mem/pmm.h>
+#include <mem/profile.h>
+#include <mem/slab.h>
 #include <mem/vmm.h>
 
 #include <tsk/sched.h>
 
+#include <utl/bench.h>
 #include <utl/serial.h>
 
 static volatile struct limine_framebuffer_request framebuffer_request = {
@@ -166,6 +174,8 @@ int is_vmware_backdoor(void) {
 #if 0
 // Entry-point for secondary cores
 static void KeSMPMain(struct limine_smp_info *info) {
+    CpuInitializeLocal(info->processor_id);
+    MmInitializePat();
     ComPrint("Secondary core %d started\n", info->processor_id);
 
     while (1) {
@@ -184,10 +194,19 @@ void KeMain(void) {
     ComPrint("[KERNEL] Primary core started.\n");
 
     IntelInitialize(stack);
+    CpuInitializeLocal(0);
+    RtInitializeMemory();
 
     MmInitialize();
+    MmInitializeBuddy();
     MmInitializePaging();
     MmInitializeHeap();
+    MmInitializeDma();
+
+#ifdef KERNEL_BENCHMARK
+    BenchRunAll();
+    BenchRunSmp(smp_request.response);
+#endif
 
     TskInitialize();
 
@@ -231,6 +250,12 @@ void KeMain(void) {
     TskCreateKernelTask("Test Task 2", TestTask2);
 
     TskPrintTasks();
+    KmPrintCaches();
+
+#ifdef HEAP_PROFILE
+    HeapProfilePrint();
+#endif
+
 #if 0
     // Start up the other cores
     struct limine_smp_response *smp = smp_request.response;
@@ -238,6 +263,9 @@ void KeMain(void) {
         smp->cpus[i]->goto_address = KeSMPMain;
 #endif
 
-    // Main loop
-    while (1) __asm__ volatile("hlt");
+    // Main loop, the boot core is idle from here on and keeps the zeroed page pool topped up.
+    while (1) {
+        if (!MmRefillZeroedPages(MM_ZERO_POOL_BATCH))
+            __asm__ volatile("hlt");
+    }
 }
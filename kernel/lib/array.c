@@ -1,39 +1,77 @@
 #include "array.h"
 #include <lib/memory.h>
+#include <mem/kmalloc.h>
+#include <utl/serial.h>
 
 int8_t PointerPredicate(void *a, void *b) {
     return (a < b) ? 1 : 0;
 }
 
 OrderedArray ArrayCreate(void *address, uint32_t capacity, ArrayCompare predicate) {
+    // Slots past `size` are never read, so the storage does not have to be cleared up front.
     OrderedArray array;
     array.array = (void **) address;
-    RtZeroMemory(array.array, capacity * sizeof(void *));
 
     array.size = 0;
     array.capacity = capacity;
     array.predicate = predicate;
+    array.allocated = 0;
 
     return array;
 }
 
-void ArrayInsert(OrderedArray *array, void *item) {
-    uint32_t iterator = 0;
-    while (iterator < array->size && array->predicate(array->array[iterator], item))
-        iterator++;
-    if (iterator == array->size) {
-        array->array[array->size++] = item;
-        return;
+OrderedArray ArrayAllocate(uint32_t capacity, ArrayCompare predicate) {
+    if (!capacity)
+        capacity = 1;
+
+    OrderedArray array = ArrayCreate(kmalloc(capacity * sizeof(void *)), capacity, predicate);
+    if (!array.array)
+        array.capacity = 0;
+    array.allocated = 1;
+    return array;
+}
+
+void ArrayDestroy(OrderedArray *array) {
+    if (array->allocated)
+        kfree(array->array);
+
+    array->array = 0;
+    array->size = 0;
+    array->capacity = 0;
+}
+
+uint32_t ArrayLowerBound(OrderedArray *array, void *item) {
+    uint32_t low = 0, high = array->size;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (array->predicate(array->array[middle], item))
+            low = middle + 1;
+        else
+            high = middle;
     }
-    void *tmp = array->array[iterator];
-    array->array[iterator] = item;
-    while (iterator < array->size) {
-        iterator++;
-        void *tmp2 = array->array[iterator];
-        array->array[iterator] = tmp;
-        tmp = tmp2;
+
+    return low;
+}
+
+uint8_t ArrayInsert(OrderedArray *array, void *item) {
+    if (array->size == array->capacity) {
+        uint32_t capacity = array->capacity ? array->capacity * 2 : 1;
+        void **grown = array->allocated ? krealloc(array->array, capacity * sizeof(void *)) : 0;
+        if (!grown) {
+            ComPrint("[ARRAY] Out of space inserting into an array of %d elements\n", array->capacity);
+            return 0;
+        }
+
+        array->array = grown;
+        array->capacity = capacity;
     }
+
+    // The new element goes in front of the first one that does not sort before it.
+    uint32_t index = ArrayLowerBound(array, item);
+    RtMoveMemory(&array->array[index + 1], &array->array[index], (array->size - index) * sizeof(void *));
+    array->array[index] = item;
     array->size++;
+    return 1;
 }
 
 void *ArrayGet(OrderedArray *array, uint32_t index) {
@@ -41,9 +79,26 @@ void *ArrayGet(OrderedArray *array, uint32_t index) {
 }
 
 void ArrayRemove(OrderedArray *array, uint32_t index) {
-    while (index < array->size) {
-        array->array[index] = array->array[index + 1];
-        index++;
-    }
+    if (index >= array->size)
+        return;
+
+    RtMoveMemory(&array->array[index], &array->array[index + 1], (array->size - index - 1) * sizeof(void *));
     array->size--;
 }
+
+int64_t ArrayFind(OrderedArray *array, void *key, ArrayKeyCompare compare) {
+    uint32_t low = 0, high = array->size;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        int order = compare(array->array[middle], key);
+        if (!order)
+            return middle;
+
+        if (order < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return -1;
+}
@@ -2,19 +2,35 @@
 
 #include <stdint.h>
 
+// Returns non-zero when `a` sorts before `b`.
 typedef int8_t (*ArrayCompare)(void *, void *);
 
+// Three-way comparison of an element with a search key, negative when the element sorts before the key.
+typedef int (*ArrayKeyCompare)(void *item, void *key);
+
+// Elements are kept sorted by `predicate`. Arrays on caller-provided storage stay at their capacity, arrays from
+// ArrayAllocate double in size whenever they run full.
 typedef struct OrderedArray {
     void **array;
     uint32_t size;
     uint32_t capacity;
     ArrayCompare predicate;
+    uint8_t allocated;
 } OrderedArray;
 
 int8_t PointerPredicate(void *a, void *b);
 
 OrderedArray ArrayCreate(void *address, uint32_t capacity, ArrayCompare predicate);
+OrderedArray ArrayAllocate(uint32_t capacity, ArrayCompare predicate);
+void ArrayDestroy(OrderedArray *array);
 
-void ArrayInsert(OrderedArray *array, void *item);
+// Returns 0 when the array is full and can't grow.
+uint8_t ArrayInsert(OrderedArray *array, void *item);
 void *ArrayGet(OrderedArray *array, uint32_t index);
 void ArrayRemove(OrderedArray *array, uint32_t index);
+
+// Index of the first element that does not sort before `item`, `size` if there is none.
+uint32_t ArrayLowerBound(OrderedArray *array, void *item);
+
+// Index of an element that compares equal to `key`, or -1. `compare` has to agree with the array's order.
+int64_t ArrayFind(OrderedArray *array, void *key, ArrayKeyCompare compare);
@@ -0,0 +1,110 @@
+#include "bitmap.h"
+#include "memory.h"
+
+void BitmapInitialize(Bitmap *bitmap, uint64_t *words, uint64_t bits) {
+    bitmap->words = words;
+    bitmap->bits = bits;
+    RtZeroMemory(words, BITMAP_WORDS(bits) * sizeof(uint64_t));
+}
+
+uint64_t BitmapSetRange(Bitmap *bitmap, uint64_t first, uint64_t end) {
+    if (end > bitmap->bits)
+        end = bitmap->bits;
+
+    uint64_t changed = 0;
+    for (uint64_t word = first >> 6; first < end && (word << 6) < end; word++) {
+        uint64_t mask = BitmapWordMask(word, first, end);
+        changed += BitmapCountBits(mask & ~bitmap->words[word]);
+        bitmap->words[word] |= mask;
+    }
+
+    return changed;
+}
+
+uint64_t BitmapClearRange(Bitmap *bitmap, uint64_t first, uint64_t end) {
+    if (end > bitmap->bits)
+        end = bitmap->bits;
+
+    uint64_t changed = 0;
+    for (uint64_t word = first >> 6; first < end && (word << 6) < end; word++) {
+        uint64_t mask = BitmapWordMask(word, first, end);
+        changed += BitmapCountBits(mask & bitmap->words[word]);
+        bitmap->words[word] &= ~mask;
+    }
+
+    return changed;
+}
+
+uint64_t BitmapCount(Bitmap *bitmap, uint64_t first, uint64_t end) {
+    if (end > bitmap->bits)
+        end = bitmap->bits;
+
+    uint64_t count = 0;
+    for (uint64_t word = first >> 6; first < end && (word << 6) < end; word++)
+        count += BitmapCountBits(bitmap->words[word] & BitmapWordMask(word, first, end));
+
+    return count;
+}
+
+// Both searches look for a set bit, the zero search just looks at the inverted words.
+static int64_t BitmapFind(Bitmap *bitmap, uint64_t first, uint64_t end, uint64_t invert) {
+    if (end > bitmap->bits)
+        end = bitmap->bits;
+
+    for (uint64_t word = first >> 6; first < end && (word << 6) < end; word++) {
+        uint64_t bits = (bitmap->words[word] ^ invert) & BitmapWordMask(word, first, end);
+        if (bits)
+            return (int64_t) ((word << 6) + __builtin_ctzll(bits));
+    }
+
+    return -1;
+}
+
+int64_t BitmapFindZero(Bitmap *bitmap, uint64_t first, uint64_t end) {
+    return BitmapFind(bitmap, first, end, ~0ull);
+}
+
+int64_t BitmapFindSet(Bitmap *bitmap, uint64_t first, uint64_t end) {
+    return BitmapFind(bitmap, first, end, 0);
+}
+
+int64_t BitmapFindRun(Bitmap *bitmap, uint64_t first, uint64_t end, uint64_t count, uint64_t alignment) {
+    if (!count || !alignment || (alignment & (alignment - 1)))
+        return -1;
+
+    if (end > bitmap->bits)
+        end = bitmap->bits;
+
+    // A set bit inside a candidate run moves the search past it, so the scan never goes backwards.
+    int64_t candidate = BitmapFindZero(bitmap, first, end);
+    while (candidate >= 0) {
+        uint64_t start = ((uint64_t) candidate + alignment - 1) & ~(alignment - 1);
+        if (start >= end || end - start < count)
+            return -1;
+
+        int64_t used = BitmapFindSet(bitmap, start, start + count);
+        if (used < 0)
+            return (int64_t) start;
+
+        candidate = BitmapFindZero(bitmap, used + 1, end);
+    }
+
+    return -1;
+}
+
+int64_t BitmapAllocateAtomic(Bitmap *bitmap) {
+    for (uint64_t word = 0; word < BITMAP_WORDS(bitmap->bits); word++) {
+        uint64_t mask = BitmapWordMask(word, 0, bitmap->bits);
+        uint64_t old = __atomic_load_n(&bitmap->words[word], __ATOMIC_RELAXED);
+
+        // A failed exchange reloads `old`, so a word another CPU just filled up is left behind.
+        while (~old & mask) {
+            uint64_t bit = __builtin_ctzll(~old & mask);
+            if (__atomic_compare_exchange_n(&bitmap->words[word], &old, old | (1ull << bit), 0, __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED))
+                return (int64_t) ((word << 6) + bit);
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+#define BITMAP_WORDS(bits) (((bits) + 63) / 64)
+#define BITMAP_BIT(index) (1ull << ((index) & 63))
+
+// Bits live in 64-bit words, searches look at a whole word per step and pick the bit with tzcnt. Bits of the last
+// word past `bits` are never reported by a search.
+typedef struct Bitmap {
+    uint64_t *words;
+    uint64_t bits;
+} Bitmap;
+
+static inline uint8_t BitmapTest(Bitmap *bitmap, uint64_t index) {
+    return (bitmap->words[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void BitmapSet(Bitmap *bitmap, uint64_t index) {
+    bitmap->words[index >> 6] |= BITMAP_BIT(index);
+}
+
+static inline void BitmapClear(Bitmap *bitmap, uint64_t index) {
+    bitmap->words[index >> 6] &= ~BITMAP_BIT(index);
+}
+
+// The atomic variants may race with each other, but not with the plain ones.
+static inline uint8_t BitmapTestAndSetAtomic(Bitmap *bitmap, uint64_t index) {
+    return !!(__atomic_fetch_or(&bitmap->words[index >> 6], BITMAP_BIT(index), __ATOMIC_ACQUIRE) & BITMAP_BIT(index));
+}
+
+static inline void BitmapClearAtomic(Bitmap *bitmap, uint64_t index) {
+    __atomic_fetch_and(&bitmap->words[index >> 6], ~BITMAP_BIT(index), __ATOMIC_RELEASE);
+}
+
+// The bits of `word` that fall into [first, end).
+static inline uint64_t BitmapWordMask(uint64_t word, uint64_t first, uint64_t end) {
+    uint64_t mask = ~0ull;
+    if (first > (word << 6))
+        mask &= ~0ull << (first & 63);
+    if (end < ((word + 1) << 6))
+        mask &= (1ull << (end & 63)) - 1;
+    return mask;
+}
+
+// Without -mpopcnt __builtin_popcountll becomes a libgcc call, which the kernel doesn't link.
+static inline uint64_t BitmapCountBits(uint64_t value) {
+    value = value - ((value >> 1) & 0x5555555555555555);
+    value = (value & 0x3333333333333333) + ((value >> 2) & 0x3333333333333333);
+    value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0F;
+    return (value * 0x0101010101010101) >> 56;
+}
+
+// Points the bitmap at BITMAP_WORDS(bits) words of storage and clears them.
+void BitmapInitialize(Bitmap *bitmap, uint64_t *words, uint64_t bits);
+
+// Range updates cover [first, end) and return how many bits actually changed.
+uint64_t BitmapSetRange(Bitmap *bitmap, uint64_t first, uint64_t end);
+uint64_t BitmapClearRange(Bitmap *bitmap, uint64_t first, uint64_t end);
+uint64_t BitmapCount(Bitmap *bitmap, uint64_t first, uint64_t end);
+
+// Searches return the lowest matching index in [first, end), or -1.
+int64_t BitmapFindZero(Bitmap *bitmap, uint64_t first, uint64_t end);
+int64_t BitmapFindSet(Bitmap *bitmap, uint64_t first, uint64_t end);
+
+// Finds `count` clear bits in a row starting at a multiple of `alignment`, which is a power of two.
+int64_t BitmapFindRun(Bitmap *bitmap, uint64_t first, uint64_t end, uint64_t count, uint64_t alignment);
+
+// Claims the lowest clear bit, safe against other CPUs doing the same without a lock. Returns -1 when full.
+int64_t BitmapAllocateAtomic(Bitmap *bitmap);
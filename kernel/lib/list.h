@@ -83,4 +83,4 @@
     for ((var) = ((head)->first); (var); (var) = ((var)->name.next))
 
 #define RLIST_FOREACH(var, el, name) \
-    for ((var) = (el); (var); (var) = ((var)->name.next))
\ No newline at end of file
+    for ((var) = (el); (var); (var) = ((var)->name.next))
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct Spinlock {
+    volatile uint32_t locked;
+} Spinlock;
+
+#define SPINLOCK_INIT \
+    { 0 }
+
+static inline void RtAcquireSpinlock(Spinlock *lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (lock->locked)
+            __asm__ volatile("pause");
+    }
+}
+
+static inline void RtReleaseSpinlock(Spinlock *lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
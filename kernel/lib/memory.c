@@ -1,53 +1,199 @@
 #include "memory.h"
 
+#include <cpu/intel.h>
 #include <stddef.h>
+#include <utl/serial.h>
 
-void RtZeroMemory(void *address, uint64_t size) {
-    uint8_t *ptr = (uint8_t *) address;
-    for (uint64_t i = 0; i < size; i++) {
-        ptr[i] = 0;
+// Lets word-sized loads and stores go through unaligned pointers into any object.
+typedef uint64_t __attribute__((may_alias, aligned(1))) RtWord;
+
+// Keeps the compiler from turning the word loops back into calls to memcpy and memset, which land here again.
+#define RT_NO_LIBCALLS __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+typedef void (*RtCopyRoutine)(void *destination, const void *source, uint64_t size);
+typedef void (*RtFillRoutine)(void *address, uint64_t size, uint8_t value);
+
+static RT_NO_LIBCALLS void RtCopySmall(uint8_t *to, const uint8_t *from, uint64_t size) {
+    for (; size >= sizeof(RtWord); size -= sizeof(RtWord), to += sizeof(RtWord), from += sizeof(RtWord))
+        *(RtWord *) to = *(const RtWord *) from;
+    for (; size; size--)
+        *to++ = *from++;
+}
+
+static RT_NO_LIBCALLS void RtFillSmall(uint8_t *to, uint64_t size, uint64_t pattern) {
+    for (; size >= sizeof(RtWord); size -= sizeof(RtWord), to += sizeof(RtWord))
+        *(RtWord *) to = pattern;
+    for (; size; size--)
+        *to++ = (uint8_t) pattern;
+}
+
+static void RtCopyQwords(void *destination, const void *source, uint64_t size) {
+    if (size < RT_MEMORY_SMALL) {
+        RtCopySmall((uint8_t *) destination, (const uint8_t *) source, size);
+        return;
     }
+
+    uint64_t qwords = size >> 3, bytes = size & 7;
+    __asm__ volatile("rep movsq"
+                     : "+D"(destination), "+S"(source), "+c"(qwords)::"memory");
+    __asm__ volatile("rep movsb"
+                     : "+D"(destination), "+S"(source), "+c"(bytes)::"memory");
+}
+
+static void RtCopyBytes(void *destination, const void *source, uint64_t size) {
+    __asm__ volatile("rep movsb"
+                     : "+D"(destination), "+S"(source), "+c"(size)::"memory");
+}
+
+static void RtCopyErms(void *destination, const void *source, uint64_t size) {
+    if (size >= RT_MEMORY_ERMS_THRESHOLD)
+        RtCopyBytes(destination, source, size);
+    else
+        RtCopyQwords(destination, source, size);
+}
+
+static void RtFillQwords(void *address, uint64_t size, uint8_t value) {
+    uint64_t pattern = 0x0101010101010101ull * value;
+    if (size < RT_MEMORY_SMALL) {
+        RtFillSmall((uint8_t *) address, size, pattern);
+        return;
+    }
+
+    uint64_t qwords = size >> 3, bytes = size & 7;
+    __asm__ volatile("rep stosq"
+                     : "+D"(address), "+c"(qwords)
+                     : "a"(pattern)
+                     : "memory");
+    __asm__ volatile("rep stosb"
+                     : "+D"(address), "+c"(bytes)
+                     : "a"(pattern)
+                     : "memory");
+}
+
+static void RtFillErms(void *address, uint64_t size, uint8_t value) {
+    if (size < RT_MEMORY_ERMS_THRESHOLD) {
+        RtFillQwords(address, size, value);
+        return;
+    }
+
+    __asm__ volatile("rep stosb"
+                     : "+D"(address), "+c"(size)
+                     : "a"(value)
+                     : "memory");
+}
+
+// The qword variants work on every x86-64 CPU, so the primitives are usable before RtInitializeMemory ran.
+static RtCopyRoutine kRtCopy = RtCopyQwords;
+static RtFillRoutine kRtFill = RtFillQwords;
+static uint32_t kRtMemoryFeatures = 0;
+
+void RtInitializeMemory(void) {
+    uint32_t eax, ebx, ecx, edx;
+    IntelCpuid(0, 0, &eax, &ebx, &ecx, &edx);
+
+    kRtMemoryFeatures = 0;
+    if (eax >= 7) {
+        IntelCpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx & (1 << 9))
+            kRtMemoryFeatures |= RT_MEMORY_ERMS;
+        if (edx & (1 << 4))
+            kRtMemoryFeatures |= RT_MEMORY_FSRM;
+    }
+
+    // Fast short rep movsb makes the byte variant the best choice for every size.
+    if (kRtMemoryFeatures & RT_MEMORY_FSRM)
+        kRtCopy = RtCopyBytes;
+    else if (kRtMemoryFeatures & RT_MEMORY_ERMS)
+        kRtCopy = RtCopyErms;
+
+    if (kRtMemoryFeatures & RT_MEMORY_ERMS)
+        kRtFill = RtFillErms;
+
+    ComPrint("[RT] Memory primitives: %s copy, %s fill\n",
+             kRtCopy == RtCopyBytes ? "rep movsb" : kRtCopy == RtCopyErms ? "rep movsq/movsb" : "rep movsq",
+             kRtFill == RtFillErms ? "rep stosq/stosb" : "rep stosq");
+}
+
+uint32_t RtGetMemoryFeatures(void) {
+    return kRtMemoryFeatures;
+}
+
+void RtZeroMemory(void *address, uint64_t size) {
+    kRtFill(address, size, 0);
 }
 
 void RtCopyMemory(void *destination, const void *source, uint64_t size) {
-    uint8_t *dest = (uint8_t *) destination;
-    const uint8_t *src = (const uint8_t *) source;
-    for (uint64_t i = 0; i < size; i++) {
-        dest[i] = src[i];
+    kRtCopy(destination, source, size);
+}
+
+RT_NO_LIBCALLS void RtMoveMemory(void *destination, const void *source, uint64_t size) {
+    // Forward copies are safe unless the destination starts inside the source.
+    if ((uint64_t) destination - (uint64_t) source >= size) {
+        kRtCopy(destination, source, size);
+        return;
+    }
+
+    // Copy from the end, a word at a time. Every word is read before the copy reaches the bytes it overlaps.
+    uint8_t *to = (uint8_t *) destination;
+    const uint8_t *from = (const uint8_t *) source;
+    while (size >= sizeof(RtWord)) {
+        size -= sizeof(RtWord);
+        *(RtWord *) (to + size) = *(const RtWord *) (from + size);
+    }
+
+    while (size) {
+        size--;
+        to[size] = from[size];
     }
 }
 
 void RtFillMemory(void *address, uint64_t size, uint8_t value) {
-    uint8_t *ptr = (uint8_t *) address;
-    for (uint64_t i = 0; i < size; i++) {
-        ptr[i] = value;
+    kRtFill(address, size, value);
+}
+
+RT_NO_LIBCALLS int RtCompareMemory(const void *a, const void *b, uint64_t size) {
+    const uint8_t *left = (const uint8_t *) a;
+    const uint8_t *right = (const uint8_t *) b;
+
+    // Compare a word at a time, the lowest differing bit of the two words points at the first differing byte.
+    while (size >= sizeof(RtWord)) {
+        uint64_t x = *(const RtWord *) left, y = *(const RtWord *) right;
+        if (x != y) {
+            uint64_t shift = __builtin_ctzll(x ^ y) & ~7ull;
+            return (int) ((x >> shift) & 0xFF) - (int) ((y >> shift) & 0xFF);
+        }
+
+        left += sizeof(RtWord);
+        right += sizeof(RtWord);
+        size -= sizeof(RtWord);
     }
+
+    for (; size; size--, left++, right++) {
+        if (*left != *right)
+            return *left - *right;
+    }
+
+    return 0;
 }
 
-// GNU Freestanding requires us to have these:
+#ifndef HOST_BUILD
+// GNU Freestanding requires us to have these, the host build links against the C library instead:
 void *memcpy(void *dest, const void *source, size_t size) {
     RtCopyMemory(dest, source, size);
     return dest;
 }
 
-
 void *memmove(void *dest, const void *source, size_t size) {
-    RtCopyMemory(dest, source, size);
+    RtMoveMemory(dest, source, size);
     return dest;
 }
 
-void *memset(void * addr, int data, size_t length) {
+void *memset(void *addr, int data, size_t length) {
     RtFillMemory(addr, length, data);
     return addr;
 }
 
-int memcmp(const void * a, const void * b, size_t size) {
-    uint8_t *ptr1 = (uint8_t *) a;
-    uint8_t *ptr2 = (uint8_t *) b;
-    for (uint64_t i = 0; i < size; i++) {
-        if (ptr1[i] != ptr2[i]) {
-            return ptr1[i] - ptr2[i];
-        }
-    }
-    return 0;
+int memcmp(const void *a, const void *b, size_t size) {
+    return RtCompareMemory(a, b, size);
 }
+#endif
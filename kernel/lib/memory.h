@@ -2,6 +2,21 @@
 
 #include <stdint.h>
 
+// CPU features RtInitializeMemory picks the copy and fill routines by.
+#define RT_MEMORY_ERMS 0x1
+#define RT_MEMORY_FSRM 0x2
+
+// Below this size the startup cost of a rep instruction outweighs the copy, plain word moves are used instead.
+#define RT_MEMORY_SMALL 64
+
+// With ERMS, byte-sized rep movsb/stosb beats the qword variants from this size on.
+#define RT_MEMORY_ERMS_THRESHOLD 256
+
+void RtInitializeMemory(void);
+uint32_t RtGetMemoryFeatures(void);
+
 void RtZeroMemory(void *address, uint64_t size);
 void RtCopyMemory(void *destination, const void *source, uint64_t size);
-void RtFillMemory(void *address, uint64_t size, uint8_t value);
\ No newline at end of file
+void RtMoveMemory(void *destination, const void *source, uint64_t size);
+void RtFillMemory(void *address, uint64_t size, uint8_t value);
+int RtCompareMemory(const void *a, const void *b, uint64_t size);
@@ -0,0 +1,306 @@
+#include "rbtree.h"
+
+#define RB_IS_RED(node) ((node) && (node)->color == RB_RED)
+
+// Points whatever linked to `old` at `new`, which takes over the parent of `old`.
+static void RbReplaceChild(RbTree *tree, RbNode *old, RbNode *new) {
+    RbNode *parent = old->parent;
+    if (!parent)
+        tree->root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+
+    if (new)
+        new->parent = parent;
+}
+
+// Rotations don't change which nodes are below the pair, so only the two rotated nodes need their augmented values
+// recomputed, the lower one first.
+static void RbRotateLeft(RbTree *tree, RbNode *node) {
+    RbNode *right = node->right;
+    RbReplaceChild(tree, node, right);
+
+    node->right = right->left;
+    if (right->left)
+        right->left->parent = node;
+
+    right->left = node;
+    node->parent = right;
+
+    if (tree->augment) {
+        tree->augment(node);
+        tree->augment(right);
+    }
+}
+
+static void RbRotateRight(RbTree *tree, RbNode *node) {
+    RbNode *left = node->left;
+    RbReplaceChild(tree, node, left);
+
+    node->left = left->right;
+    if (left->right)
+        left->right->parent = node;
+
+    left->right = node;
+    node->parent = left;
+
+    if (tree->augment) {
+        tree->augment(node);
+        tree->augment(left);
+    }
+}
+
+void RbPropagate(RbTree *tree, RbNode *node) {
+    if (!tree->augment)
+        return;
+
+    for (; node; node = node->parent)
+        tree->augment(node);
+}
+
+static void RbInsertFixup(RbTree *tree, RbNode *node) {
+    while (RB_IS_RED(node->parent)) {
+        RbNode *parent = node->parent;
+        RbNode *grandparent = parent->parent;
+
+        if (parent == grandparent->left) {
+            RbNode *uncle = grandparent->right;
+            if (RB_IS_RED(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->right) {
+                RbRotateLeft(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            RbRotateRight(tree, grandparent);
+        } else {
+            RbNode *uncle = grandparent->left;
+            if (RB_IS_RED(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                grandparent->color = RB_RED;
+                node = grandparent;
+                continue;
+            }
+
+            if (node == parent->left) {
+                RbRotateRight(tree, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            grandparent->color = RB_RED;
+            RbRotateLeft(tree, grandparent);
+        }
+    }
+
+    tree->root->color = RB_BLACK;
+}
+
+void RbInsert(RbTree *tree, RbNode *node, RbCompare compare) {
+    RbNode *parent = 0;
+    RbNode **link = &tree->root;
+    while (*link) {
+        parent = *link;
+        link = compare(node, parent) < 0 ? &parent->left : &parent->right;
+    }
+
+    node->parent = parent;
+    node->left = 0;
+    node->right = 0;
+    node->color = RB_RED;
+    *link = node;
+
+    RbPropagate(tree, node);
+    RbInsertFixup(tree, node);
+}
+
+// `node` took the place of a black node and is short one black node on its paths. It may be null, so its parent
+// is passed along.
+static void RbRemoveFixup(RbTree *tree, RbNode *node, RbNode *parent) {
+    while (node != tree->root && !RB_IS_RED(node)) {
+        if (node == parent->left) {
+            RbNode *sibling = parent->right;
+            if (RB_IS_RED(sibling)) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                RbRotateLeft(tree, parent);
+                sibling = parent->right;
+            }
+
+            if (!RB_IS_RED(sibling->left) && !RB_IS_RED(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!RB_IS_RED(sibling->right)) {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                RbRotateRight(tree, sibling);
+                sibling = parent->right;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            RbRotateLeft(tree, parent);
+        } else {
+            RbNode *sibling = parent->left;
+            if (RB_IS_RED(sibling)) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                RbRotateRight(tree, parent);
+                sibling = parent->left;
+            }
+
+            if (!RB_IS_RED(sibling->left) && !RB_IS_RED(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (!RB_IS_RED(sibling->left)) {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                RbRotateLeft(tree, sibling);
+                sibling = parent->left;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            RbRotateRight(tree, parent);
+        }
+
+        node = tree->root;
+    }
+
+    if (node)
+        node->color = RB_BLACK;
+}
+
+void RbRemove(RbTree *tree, RbNode *node) {
+    RbNode *child, *parent;
+    uint8_t color;
+
+    if (!node->left || !node->right) {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        color = node->color;
+        RbReplaceChild(tree, node, child);
+    } else {
+        // Two children: the successor is unlinked from its spot and takes over the place and color of `node`.
+        RbNode *successor = node->right;
+        while (successor->left)
+            successor = successor->left;
+
+        child = successor->right;
+        color = successor->color;
+
+        if (successor->parent == node) {
+            parent = successor;
+        } else {
+            parent = successor->parent;
+            parent->left = child;
+            if (child)
+                child->parent = parent;
+
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+
+        successor->left = node->left;
+        node->left->parent = successor;
+        successor->color = node->color;
+        RbReplaceChild(tree, node, successor);
+    }
+
+    // Everything from the lowest changed node up to the root lost a node, the successor included.
+    RbPropagate(tree, parent);
+
+    if (color == RB_BLACK)
+        RbRemoveFixup(tree, child, parent);
+}
+
+RbNode *RbFind(RbTree *tree, void *key, RbKeyCompare compare) {
+    RbNode *node = tree->root;
+    while (node) {
+        int order = compare(node, key);
+        if (!order)
+            return node;
+
+        node = order < 0 ? node->right : node->left;
+    }
+
+    return 0;
+}
+
+RbNode *RbLowerBound(RbTree *tree, void *key, RbKeyCompare compare) {
+    RbNode *node = tree->root;
+    RbNode *bound = 0;
+    while (node) {
+        if (compare(node, key) < 0) {
+            node = node->right;
+        } else {
+            bound = node;
+            node = node->left;
+        }
+    }
+
+    return bound;
+}
+
+RbNode *RbFirst(RbTree *tree) {
+    RbNode *node = tree->root;
+    while (node && node->left)
+        node = node->left;
+    return node;
+}
+
+RbNode *RbLast(RbTree *tree) {
+    RbNode *node = tree->root;
+    while (node && node->right)
+        node = node->right;
+    return node;
+}
+
+RbNode *RbNext(RbNode *node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return node;
+    }
+
+    while (node->parent && node == node->parent->right)
+        node = node->parent;
+    return node->parent;
+}
+
+RbNode *RbPrev(RbNode *node) {
+    if (node->left) {
+        node = node->left;
+        while (node->right)
+            node = node->right;
+        return node;
+    }
+
+    while (node->parent && node == node->parent->left)
+        node = node->parent;
+    return node->parent;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+// Nodes are embedded in the structure they link, RB_CONTAINER gets back from the node to that structure.
+typedef struct RbNode {
+    struct RbNode *parent;
+    struct RbNode *left;
+    struct RbNode *right;
+    uint8_t color;
+} RbNode;
+
+// Recomputes the value `node` caches about its subtree, like a subtree maximum, from its own fields and the values
+// cached by its children. The tree calls it for every node whose subtree changed, bottom up.
+typedef void (*RbAugment)(RbNode *node);
+
+typedef struct RbTree {
+    RbNode *root;
+    RbAugment augment;
+} RbTree;
+
+// Negative when `a` sorts before `b`. Equal nodes are inserted behind the ones already in the tree.
+typedef int (*RbCompare)(RbNode *a, RbNode *b);
+
+// Three-way comparison of a node with a search key, negative when the node sorts before the key.
+typedef int (*RbKeyCompare)(RbNode *node, void *key);
+
+#define RB_TREE_INIT \
+    { 0, 0 }
+
+#define RB_TREE_INIT_AUGMENTED(augment) \
+    { 0, (augment) }
+
+#define RB_INIT(tree, fn)          \
+    {                              \
+        (tree)->root = 0;          \
+        (tree)->augment = (fn);    \
+    }
+
+static inline void *RbContainer(RbNode *node, uint64_t offset) {
+    return node ? (void *) ((uint8_t *) node - offset) : 0;
+}
+
+#define RB_CONTAINER(node, type, name) ((type *) RbContainer((node), __builtin_offsetof(type, name)))
+
+#define RB_FIRST(tree, type, name) RB_CONTAINER(RbFirst(tree), type, name)
+#define RB_LAST(tree, type, name) RB_CONTAINER(RbLast(tree), type, name)
+#define RB_NEXT(el, type, name) RB_CONTAINER(RbNext(&(el)->name), type, name)
+#define RB_PREV(el, type, name) RB_CONTAINER(RbPrev(&(el)->name), type, name)
+
+#define RB_INSERT(tree, el, compare, name) RbInsert((tree), &(el)->name, (compare))
+#define RB_REMOVE(tree, el, name) RbRemove((tree), &(el)->name)
+
+#define RB_FIND(tree, key, compare, type, name) RB_CONTAINER(RbFind((tree), (key), (compare)), type, name)
+#define RB_LOWER_BOUND(tree, key, compare, type, name) \
+    RB_CONTAINER(RbLowerBound((tree), (key), (compare)), type, name)
+
+#define RB_FOREACH(var, tree, type, name) \
+    for ((var) = RB_FIRST(tree, type, name); (var); (var) = RB_NEXT(var, type, name))
+
+void RbInsert(RbTree *tree, RbNode *node, RbCompare compare);
+void RbRemove(RbTree *tree, RbNode *node);
+
+// Lookups are O(log n). RbLowerBound returns the first node that does not sort before `key`.
+RbNode *RbFind(RbTree *tree, void *key, RbKeyCompare compare);
+RbNode *RbLowerBound(RbTree *tree, void *key, RbKeyCompare compare);
+
+RbNode *RbFirst(RbTree *tree);
+RbNode *RbLast(RbTree *tree);
+RbNode *RbNext(RbNode *node);
+RbNode *RbPrev(RbNode *node);
+
+// Refreshes the augmented values from `node` up to the root, after fields they depend on changed in place.
+void RbPropagate(RbTree *tree, RbNode *node);
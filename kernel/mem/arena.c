@@ -0,0 +1,163 @@
+#include "arena.h"
+#include "buddy.h"
+#include "pmm.h"
+
+#include <cpu/intel.h>
+#include <utl/serial.h>
+
+#define KM_ARENA_ALIGN_UP(value, alignment) (((value) + (alignment) - 1) & ~((uint64_t) (alignment) - 1))
+#define KM_ARENA_BYTES(order) ((uint64_t) PAGE_SIZE << (order))
+#define KM_ARENA_HEADER KM_ARENA_ALIGN_UP(sizeof(KmArenaChunk), KM_ARENA_ALIGN)
+
+static int KmArenaCompareChunks(RbNode *a, RbNode *b) {
+    uint64_t x = (uint64_t) RB_CONTAINER(a, KmArenaChunk, node), y = (uint64_t) RB_CONTAINER(b, KmArenaChunk, node);
+    return x < y ? -1 : x > y;
+}
+
+// An address compares equal to the chunk that contains it.
+static int KmArenaCompareAddress(RbNode *node, void *key) {
+    KmArenaChunk *chunk = RB_CONTAINER(node, KmArenaChunk, node);
+    if ((uint64_t) chunk + chunk->size <= (uint64_t) key)
+        return -1;
+    return (uint64_t) chunk > (uint64_t) key;
+}
+
+void KmArenaInitialize(KmArena *arena, const char *name) {
+    arena->name = name;
+    arena->lock = (Spinlock) SPINLOCK_INIT;
+    arena->chunk = 0;
+    RB_INIT(&arena->tree, 0);
+    arena->last = 0;
+    arena->chunks = 0;
+    arena->unreclaimed = 0;
+}
+
+static void KmArenaFreeChunk(KmArena *arena, KmArenaChunk *chunk) {
+    arena->chunk = chunk->next;
+    arena->chunks--;
+    RB_REMOVE(&arena->tree, chunk, node);
+    MmFreePages((void *) MmVirtToPhys(chunk), chunk->order);
+}
+
+void *KmArenaAlloc(KmArena *arena, uint64_t size, uint64_t align) {
+    if (align < KM_ARENA_ALIGN)
+        align = KM_ARENA_ALIGN;
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&arena->lock);
+
+    KmArenaChunk *chunk = arena->chunk;
+    uint64_t start = chunk ? KM_ARENA_ALIGN_UP((uint64_t) chunk + chunk->used, align) : 0;
+
+    if (!chunk || start + size > (uint64_t) chunk + chunk->size) {
+        // Whatever is left in the current chunk is abandoned, requests too large for a regular chunk get a larger
+        // one of their own.
+        uint64_t order = KM_ARENA_CHUNK_ORDER;
+        while (order <= MM_BUDDY_MAX_ORDER && KM_ARENA_ALIGN_UP(KM_ARENA_HEADER, align) + size > KM_ARENA_BYTES(order))
+            order++;
+
+        void *frame = order <= MM_BUDDY_MAX_ORDER ? MmRequestPages(order) : 0;
+        if (!frame) {
+            RtReleaseSpinlock(&arena->lock);
+            IntelRestoreInterrupts(flags);
+            ComPrint("[ARENA] %s: out of memory allocating 0x%X bytes\n", arena->name, size);
+            return 0;
+        }
+
+        chunk = (KmArenaChunk *) MmPhysToVirt((uint64_t) frame);
+        chunk->next = arena->chunk;
+        chunk->order = order;
+        chunk->size = KM_ARENA_BYTES(order);
+        chunk->used = KM_ARENA_HEADER;
+
+        arena->chunk = chunk;
+        arena->chunks++;
+        RB_INSERT(&arena->tree, chunk, KmArenaCompareChunks, node);
+        start = KM_ARENA_ALIGN_UP((uint64_t) chunk + chunk->used, align);
+    }
+
+    chunk->used = start + size - (uint64_t) chunk;
+    arena->last = (void *) start;
+
+    RtReleaseSpinlock(&arena->lock);
+    IntelRestoreInterrupts(flags);
+    return (void *) start;
+}
+
+void KmArenaFree(KmArena *arena, void *address) {
+    if (!address)
+        return;
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&arena->lock);
+
+    if (address == arena->last) {
+        arena->chunk->used = (uint64_t) address - (uint64_t) arena->chunk;
+        arena->last = 0;
+    } else {
+        arena->unreclaimed++;
+    }
+
+    RtReleaseSpinlock(&arena->lock);
+    IntelRestoreInterrupts(flags);
+}
+
+uint8_t KmArenaOwns(KmArena *arena, void *address) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&arena->lock);
+
+    RbNode *chunk = RbFind(&arena->tree, address, KmArenaCompareAddress);
+
+    RtReleaseSpinlock(&arena->lock);
+    IntelRestoreInterrupts(flags);
+    return chunk != 0;
+}
+
+void KmArenaGetStatistics(KmArena *arena, KmArenaStatistics *statistics) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&arena->lock);
+
+    statistics->chunks = arena->chunks;
+    statistics->reserved = 0;
+    statistics->used = 0;
+    statistics->unreclaimed = arena->unreclaimed;
+    for (KmArenaChunk *chunk = arena->chunk; chunk; chunk = chunk->next) {
+        statistics->reserved += chunk->size;
+        statistics->used += chunk->used - KM_ARENA_HEADER;
+    }
+
+    RtReleaseSpinlock(&arena->lock);
+    IntelRestoreInterrupts(flags);
+}
+
+KmArenaMark KmArenaGetMark(KmArena *arena) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&arena->lock);
+
+    KmArenaMark mark = {arena->chunk, arena->chunk ? arena->chunk->used : 0};
+
+    RtReleaseSpinlock(&arena->lock);
+    IntelRestoreInterrupts(flags);
+    return mark;
+}
+
+void KmArenaRelease(KmArena *arena, KmArenaMark mark) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&arena->lock);
+
+    // Chunks are chained newest first, everything in front of the marked one was allocated after the mark.
+    while (arena->chunk != mark.chunk)
+        KmArenaFreeChunk(arena, arena->chunk);
+
+    if (mark.chunk)
+        mark.chunk->used = mark.used;
+    arena->last = 0;
+
+    RtReleaseSpinlock(&arena->lock);
+    IntelRestoreInterrupts(flags);
+}
+
+void KmArenaDestroy(KmArena *arena) {
+    KmArenaMark empty = {0, 0};
+    KmArenaRelease(arena, empty);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <lib/lock.h>
+#include <lib/rbtree.h>
+#include <stdint.h>
+
+// Arenas hand out memory by bumping a pointer through chained buddy blocks. Nothing is freed on its own, everything
+// allocated after a mark goes away at once when the arena is released back to it.
+#define KM_ARENA_CHUNK_ORDER 4
+#define KM_ARENA_ALIGN 16
+
+typedef struct KmArenaChunk {
+    struct KmArenaChunk *next;
+    uint64_t order;
+    uint64_t size;
+    uint64_t used;
+
+    // Links the chunk into the arena's address index.
+    RbNode node;
+} KmArenaChunk;
+
+typedef struct KmArenaMark {
+    KmArenaChunk *chunk;
+    uint64_t used;
+} KmArenaMark;
+
+typedef struct KmArena {
+    const char *name;
+    Spinlock lock;
+    KmArenaChunk *chunk;
+
+    // Chunks ordered by address, so KmArenaOwns is a tree lookup instead of a walk over every chunk.
+    RbTree tree;
+
+    // The most recent allocation, it alone can be given back.
+    void *last;
+
+    uint64_t chunks;
+
+    // KmArenaFree calls that came too late to give their memory back.
+    uint64_t unreclaimed;
+} KmArena;
+
+// Byte counts come from the chunks themselves. `used` includes alignment padding, the tail a chunk was abandoned
+// with only shows up in `reserved`.
+typedef struct KmArenaStatistics {
+    uint64_t chunks;
+    uint64_t reserved;
+    uint64_t used;
+    uint64_t unreclaimed;
+} KmArenaStatistics;
+
+void KmArenaInitialize(KmArena *arena, const char *name);
+void *KmArenaAlloc(KmArena *arena, uint64_t size, uint64_t align);
+
+// Frees `address` only when it was the latest allocation, anything else stays until the arena is released.
+void KmArenaFree(KmArena *arena, void *address);
+uint8_t KmArenaOwns(KmArena *arena, void *address);
+void KmArenaGetStatistics(KmArena *arena, KmArenaStatistics *statistics);
+
+KmArenaMark KmArenaGetMark(KmArena *arena);
+void KmArenaRelease(KmArena *arena, KmArenaMark mark);
+void KmArenaDestroy(KmArena *arena);
@@ -0,0 +1,171 @@
+#include "buddy.h"
+#include "pmm.h"
+
+#include <cpu/intel.h>
+#include <lib/list.h>
+#include <lib/lock.h>
+#include <lib/memory.h>
+#include <utl/serial.h>
+
+#define BUDDY_NOT_FREE 0xFF
+
+typedef struct MmBuddyBlock {
+    LIST_ENTRY(struct MmBuddyBlock) list;
+} MmBuddyBlock;
+
+MmBuddyStatistics kBuddy;
+
+static LIST_HEAD(MmBuddyBlock) kBuddyFreeLists[MM_BUDDY_MAX_ORDER + 1];
+static Spinlock kBuddyLock = SPINLOCK_INIT;
+
+// One byte per frame: the order of the free block starting at that frame, or BUDDY_NOT_FREE.
+static uint8_t *kBuddyOrders = 0;
+static uint64_t kBuddyFirstFrame = 0;
+static uint64_t kBuddyFrames = 0;
+
+static uint8_t *MmGetOrderSlot(uint64_t frame) {
+    if (frame - kBuddyFirstFrame >= kBuddyFrames)
+        return 0;
+    return &kBuddyOrders[frame - kBuddyFirstFrame];
+}
+
+static void MmBuddyPush(uint64_t frame, uint64_t order) {
+    MmBuddyBlock *block = (MmBuddyBlock *) MmPhysToVirt(frame << 12);
+    LIST_ADD_FRONT(&kBuddyFreeLists[order], block, list);
+
+    kBuddyOrders[frame - kBuddyFirstFrame] = order;
+    kBuddy.free_blocks[order]++;
+    kBuddy.cached_pages += 1ull << order;
+}
+
+static void MmBuddyRemove(MmBuddyBlock *block, uint64_t order) {
+    LIST_REMOVE(&kBuddyFreeLists[order], block, list);
+
+    kBuddyOrders[(MmVirtToPhys(block) >> 12) - kBuddyFirstFrame] = BUDDY_NOT_FREE;
+    kBuddy.free_blocks[order]--;
+    kBuddy.cached_pages -= 1ull << order;
+}
+
+void MmInitializeBuddy(void) {
+    kBuddyFirstFrame = kMemory->first_available_page_addr >> 12;
+    kBuddyFrames = kMemory->total_available_pages;
+
+    void *orders = MmRequestContiguousPages((kBuddyFrames + PAGE_SIZE - 1) / PAGE_SIZE, 1);
+    if (!orders) {
+        ComPrint("[MM] Not enough memory for the buddy allocator.\n");
+        return;
+    }
+
+    kBuddyOrders = (uint8_t *) MmPhysToVirt((uint64_t) orders);
+
+    RtFillMemory(kBuddyOrders, kBuddyFrames, BUDDY_NOT_FREE);
+
+    ComPrint("[MM] Buddy allocator ready (max order %d).\n", MM_BUDDY_MAX_ORDER);
+}
+
+uint64_t MmGetPageOrder(uint64_t pages) {
+    uint64_t order = 0;
+    while ((1ull << order) < pages)
+        order++;
+    return order;
+}
+
+void *MmRequestPages(uint64_t order) {
+    if (order > MM_BUDDY_MAX_ORDER || !kBuddyOrders)
+        return 0;
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kBuddyLock);
+
+    uint64_t current = order;
+    while (current <= MM_BUDDY_MAX_ORDER && !kBuddyFreeLists[current].first)
+        current++;
+
+    uint64_t address;
+    if (current <= MM_BUDDY_MAX_ORDER) {
+        MmBuddyBlock *block = kBuddyFreeLists[current].first;
+        MmBuddyRemove(block, current);
+        address = MmVirtToPhys(block);
+    } else {
+        // Nothing cached, carve a whole top order block out of the bitmap so the halves can merge again later.
+        current = MM_BUDDY_MAX_ORDER;
+        address = (uint64_t) MmRequestContiguousPages(1ull << current, 1ull << current);
+        if (!address) {
+            current = order;
+            address = (uint64_t) MmRequestContiguousPages(1ull << order, 1ull << order);
+        }
+    }
+
+    // Keep the lower half and cache the upper halves until the block has the requested size.
+    while (address && current > order) {
+        current--;
+        MmBuddyPush((address >> 12) + (1ull << current), current);
+    }
+
+    RtReleaseSpinlock(&kBuddyLock);
+    IntelRestoreInterrupts(flags);
+
+    return (void *) address;
+}
+
+uint64_t MmReclaimBuddyPages(void) {
+    if (!kBuddyOrders)
+        return 0;
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kBuddyLock);
+
+    uint64_t pages = 0;
+    for (uint64_t order = 0; order <= MM_BUDDY_MAX_ORDER; order++) {
+        while (kBuddyFreeLists[order].first) {
+            MmBuddyBlock *block = kBuddyFreeLists[order].first;
+            MmBuddyRemove(block, order);
+            MmUnlockPages((void *) MmVirtToPhys(block), 1ull << order);
+            pages += 1ull << order;
+        }
+    }
+
+    RtReleaseSpinlock(&kBuddyLock);
+    IntelRestoreInterrupts(flags);
+
+    return pages;
+}
+
+void MmFreePages(void *address, uint64_t order) {
+    if (!address)
+        return;
+
+    if (order > MM_BUDDY_MAX_ORDER) {
+        ComPrint("[MM] Order %D is too large for the buddy allocator, 0x%X is not freed\n", order, address);
+        return;
+    }
+
+    if (!kBuddyOrders) {
+        MmUnlockPages(address, 1ull << order);
+        return;
+    }
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kBuddyLock);
+
+    uint64_t frame = (uint64_t) address >> 12;
+    while (order < MM_BUDDY_MAX_ORDER) {
+        uint64_t buddy = frame ^ (1ull << order);
+        uint8_t *slot = MmGetOrderSlot(buddy);
+        if (!slot || *slot != order)
+            break;
+
+        MmBuddyRemove((MmBuddyBlock *) MmPhysToVirt(buddy << 12), order);
+        frame &= ~(1ull << order);
+        order++;
+    }
+
+    // Fully merged blocks go back to the bitmap, where single page requests can find them again.
+    if (order == MM_BUDDY_MAX_ORDER)
+        MmUnlockPages((void *) (frame << 12), 1ull << order);
+    else
+        MmBuddyPush(frame, order);
+
+    RtReleaseSpinlock(&kBuddyLock);
+    IntelRestoreInterrupts(flags);
+}
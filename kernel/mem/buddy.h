@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+// Blocks of up to 2^10 pages (4 MiB) are handed out and coalesced by the buddy allocator.
+#define MM_BUDDY_MAX_ORDER 10
+
+typedef struct MmBuddyStatistics {
+    uint64_t free_blocks[MM_BUDDY_MAX_ORDER + 1];
+    uint64_t cached_pages;
+} MmBuddyStatistics;
+
+extern MmBuddyStatistics kBuddy;
+
+void MmInitializeBuddy(void);
+
+uint64_t MmGetPageOrder(uint64_t pages);
+
+void *MmRequestPages(uint64_t order);
+void MmFreePages(void *address, uint64_t order);
+
+// Returns every cached block to the bitmap and how many pages that was. Single pages are only handed out from and
+// freed to the bitmap, so MmRequestPage reclaims the split blocks instead of taking a page from the buddy lists.
+uint64_t MmReclaimBuddyPages(void);
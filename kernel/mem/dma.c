@@ -0,0 +1,76 @@
+#include "dma.h"
+#include "buddy.h"
+#include "pmm.h"
+
+#include <lib/memory.h>
+#include <utl/serial.h>
+
+static const char *kDmaClassNames[DMA_CLASSES] = {
+        "dma-64", "dma-128", "dma-256", "dma-512", "dma-1024", "dma-2048",
+};
+
+// Objects of a class are aligned to their size, so none of them straddles a boundary at least that large.
+static KmCache kDmaCaches[DMA_CLASSES];
+
+void MmInitializeDma(void) {
+    for (uint64_t class = 0; class < DMA_CLASSES; class++) {
+        uint64_t size = (uint64_t) DMA_MIN_BLOCK << class;
+        KmCacheInitialize(&kDmaCaches[class], kDmaClassNames[class], size, size, 0);
+    }
+}
+
+// The size of the naturally aligned block that satisfies both the size and the alignment of a request.
+static uint64_t DmaGetBlockSize(uint64_t size, uint64_t align) {
+    if (size < align)
+        size = align;
+
+    uint64_t block = DMA_MIN_BLOCK;
+    while (block < size)
+        block <<= 1;
+    return block;
+}
+
+void *DmaAlloc(uint64_t size, uint64_t align, uint64_t boundary, uint64_t *physical) {
+    if (!size || (align & (align - 1)) || (boundary & (boundary - 1)))
+        return 0;
+
+    uint64_t block = DmaGetBlockSize(size, align);
+    if (boundary && block > boundary) {
+        ComPrint("[DMA] 0x%X bytes can't be placed within a 0x%X byte boundary\n", size, boundary);
+        return 0;
+    }
+
+    void *address = 0;
+    if (block <= DMA_SMALL_LIMIT) {
+        address = KmCacheAlloc(&kDmaCaches[__builtin_ctzll(block / DMA_MIN_BLOCK)]);
+    } else {
+        uint64_t order = MmGetPageOrder(block / PAGE_SIZE);
+        if (order > MM_BUDDY_MAX_ORDER) {
+            ComPrint("[DMA] 0x%X bytes is more than a single buddy block\n", size);
+            return 0;
+        }
+
+        void *frame = MmRequestPages(order);
+        address = frame ? MmPhysToVirt((uint64_t) frame) : 0;
+    }
+
+    if (!address) {
+        ComPrint("[DMA] Out of memory allocating 0x%X bytes\n", size);
+        return 0;
+    }
+
+    RtZeroMemory(address, size);
+    *physical = MmVirtToPhys(address);
+    return address;
+}
+
+void DmaFree(void *address, uint64_t size, uint64_t align) {
+    if (!address)
+        return;
+
+    uint64_t block = DmaGetBlockSize(size, align);
+    if (block <= DMA_SMALL_LIMIT)
+        KmCacheFree(&kDmaCaches[__builtin_ctzll(block / DMA_MIN_BLOCK)], address);
+    else
+        MmFreePages((void *) MmVirtToPhys(address), MmGetPageOrder(block / PAGE_SIZE));
+}
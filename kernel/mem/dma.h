@@ -0,0 +1,17 @@
+#pragma once
+
+#include "slab.h"
+#include <stdint.h>
+
+// Buffers up to DMA_SMALL_LIMIT bytes are carved out of slab pages in power of two classes, larger ones get buddy
+// blocks of their own. Either way a buffer is physically contiguous and aligned to its rounded up size.
+#define DMA_MIN_BLOCK 64
+#define DMA_SMALL_LIMIT 2048
+#define DMA_CLASSES 6
+
+void MmInitializeDma(void);
+
+// Returns zeroed memory of `size` bytes aligned to `align` that doesn't cross a multiple of `boundary` (0 for no
+// limit), and stores its physical address in `physical`. DmaFree has to be given the same size and alignment.
+void *DmaAlloc(uint64_t size, uint64_t align, uint64_t boundary, uint64_t *physical);
+void DmaFree(void *address, uint64_t size, uint64_t align);
@@ -1,87 +1,267 @@
 #include "heap.h"
 #include "pmm.h"
+#include "profile.h"
+#include "vma.h"
 #include "vmm.h"
 
-#include <lib/array.h>
+#include <cpu/intel.h>
 #include <lib/memory.h>
 #include <utl/serial.h>
 
-// Implementation adapted from JamesM's kernel development tutorials.
+// Small free blocks are kept in segregated lists in the style of TLSF, a bitmap of the non-empty lists turns every
+// lookup into a single bit scan. Large free blocks are found by best fit in an AVL tree ordered by size and address.
+
+#define HEAP_MIN_SHIFT 6
+#define HEAP_ALIGN_UP(value, alignment) (((value) + (alignment) - 1) & ~((uint64_t) (alignment) - 1))
+#define HEAP_FOOTER(header) ((HeapFooter *) ((uint64_t) (header) + (header)->size - sizeof(HeapFooter)))
 
 Heap *kHeap = 0;
+Spinlock kHeapLock = SPINLOCK_INIT;
 
-static void HeapExpand(Heap *heap, uint64_t size) {
+static uint8_t HeapExpand(Heap *heap, uint64_t size) {
     if ((size & 0xFFFFF000) != 0) {
         size &= 0xFFFFF000;
         size += 0x1000;
     }
 
-    uint64_t old_size = heap->end_address - heap->start_address;
-
-    uint64_t offset = old_size;
-    while (offset < size) {
-        MmMapMemory((void *) (heap->start_address + offset), MmRequestPage());
-        offset += PAGE_SIZE;
-    }
+    if (heap->start_address + size > heap->max_address)
+        return 0;
 
+    // The whole range up to max_address is a lazy region, frames are committed when the new space is touched.
     heap->end_address = heap->start_address + size;
+    return 1;
 }
 
 static uint64_t HeapContract(Heap *heap, uint64_t size) {
-    if (size & 0x1000) {
-        size &= 0x1000;
+    if (size & 0xFFF) {
+        size &= ~0xFFF;
         size += 0x1000;
     }
 
     if (size < HEAP_MIN_SIZE)
         size = HEAP_MIN_SIZE;
 
+    // Hand the committed frames past the new end back, touching the space again commits fresh ones. While other
+    // cores are running the heap keeps its size, the VMM can't unmap until it is back to one.
     uint64_t old_size = heap->end_address - heap->start_address;
-    uint64_t offset = old_size - 0x1000;
-    while (size < offset) {
-        // free_frame(get_page(heap->start_address + i, 0, kernel_directory));
-        offset -= 0x1000;
-    }
+    if (size >= old_size || MmUnmapRange((void *) (heap->start_address + size), old_size - size, 1))
+        size = old_size;
 
     heap->end_address = heap->start_address + size;
     return size;
 }
 
-static int64_t HeapFindSmallestHole(Heap *heap, uint64_t size, int8_t page_align) {
-    uint64_t iterator = 0;
-    while (iterator < heap->index.size) {
-        HeapHeader *header = (HeapHeader *) ArrayGet(&heap->index, iterator);
-        if (page_align > 0) {
-            uint64_t location = (uint64_t) header;
-            int64_t offset = 0;
-            if (((location + sizeof(HeapHeader)) & 0xFFFFF000) != 0)
-                offset = PAGE_SIZE - (location + sizeof(HeapHeader)) % PAGE_SIZE;
-            int64_t hole_size = (int64_t) header->size - offset;
-            if (hole_size >= (int64_t) size)
-                break;
-        } else if (header->size >= size)
-            break;
-        iterator++;
+static void HeapSetBlock(HeapHeader *header, uint64_t size, uint8_t is_hole) {
+    header->magic = HEAP_MAGIC;
+    header->is_hole = is_hole;
+    header->size = size;
+
+    HeapFooter *footer = HEAP_FOOTER(header);
+    footer->magic = HEAP_MAGIC;
+    footer->header = header;
+}
+
+static uint64_t HeapLog2(uint64_t value) {
+    return 63 - __builtin_clzll(value);
+}
+
+// Every power of two between HEAP_MIN_BLOCK and HEAP_SMALL_LIMIT is split into 2^HEAP_SUBCLASS_SHIFT lists.
+static uint64_t HeapSmallClass(uint64_t size) {
+    uint64_t level = HeapLog2(size);
+    uint64_t sub = (size >> (level - HEAP_SUBCLASS_SHIFT)) & ((1 << HEAP_SUBCLASS_SHIFT) - 1);
+    return ((level - HEAP_MIN_SHIFT) << HEAP_SUBCLASS_SHIFT) + sub;
+}
+
+static int64_t HeapTreeHeight(HeapHole *node) {
+    return node ? node->height : 0;
+}
+
+static void HeapTreeUpdate(HeapHole *node) {
+    int64_t left = HeapTreeHeight(node->left);
+    int64_t right = HeapTreeHeight(node->right);
+    node->height = 1 + (left > right ? left : right);
+}
+
+static HeapHole *HeapTreeRotateLeft(HeapHole *node) {
+    HeapHole *right = node->right;
+    node->right = right->left;
+    right->left = node;
+    HeapTreeUpdate(node);
+    HeapTreeUpdate(right);
+    return right;
+}
+
+static HeapHole *HeapTreeRotateRight(HeapHole *node) {
+    HeapHole *left = node->left;
+    node->left = left->right;
+    left->right = node;
+    HeapTreeUpdate(node);
+    HeapTreeUpdate(left);
+    return left;
+}
+
+static HeapHole *HeapTreeBalance(HeapHole *node) {
+    HeapTreeUpdate(node);
+
+    int64_t balance = HeapTreeHeight(node->left) - HeapTreeHeight(node->right);
+    if (balance > 1) {
+        if (HeapTreeHeight(node->left->left) < HeapTreeHeight(node->left->right))
+            node->left = HeapTreeRotateLeft(node->left);
+        return HeapTreeRotateRight(node);
     }
 
-    if (iterator == heap->index.size)
-        return -1;
+    if (balance < -1) {
+        if (HeapTreeHeight(node->right->right) < HeapTreeHeight(node->right->left))
+            node->right = HeapTreeRotateRight(node->right);
+        return HeapTreeRotateLeft(node);
+    }
 
-    return iterator;
+    return node;
 }
 
-static int8_t HeaderPredicate(void *a, void *b) {
-    return (((HeapHeader *) a)->size < ((HeapHeader *) b)->size) ? 1 : 0;
+// Holes of the same size are told apart by their address, so every key in the tree is unique.
+static uint8_t HeapTreeBefore(HeapHole *a, HeapHole *b) {
+    if (a->header.size != b->header.size)
+        return a->header.size < b->header.size;
+    return a < b;
 }
 
-Heap *HeapCreate(uint64_t start, uint64_t end, uint64_t max, int8_t supervisor, int8_t readonly) {
-    Heap *heap = MmGetIdentityPage();
-    RtZeroMemory(heap, sizeof(Heap));
+static HeapHole *HeapTreeInsert(HeapHole *node, HeapHole *hole) {
+    if (!node)
+        return hole;
+
+    if (HeapTreeBefore(hole, node))
+        node->left = HeapTreeInsert(node->left, hole);
+    else
+        node->right = HeapTreeInsert(node->right, hole);
+
+    return HeapTreeBalance(node);
+}
+
+static HeapHole *HeapTreeRemoveMin(HeapHole *node, HeapHole **min) {
+    if (!node->left) {
+        *min = node;
+        return node->right;
+    }
+
+    node->left = HeapTreeRemoveMin(node->left, min);
+    return HeapTreeBalance(node);
+}
+
+static HeapHole *HeapTreeRemove(HeapHole *node, HeapHole *hole) {
+    if (!node)
+        return 0;
+
+    if (node == hole) {
+        if (!node->right)
+            return node->left;
+
+        HeapHole *min;
+        HeapHole *right = HeapTreeRemoveMin(node->right, &min);
+        min->left = node->left;
+        min->right = right;
+        return HeapTreeBalance(min);
+    }
 
-    heap->index = ArrayCreate((void *) start, HEAP_INDEX_SIZE, &HeaderPredicate);
-    start += sizeof(void *) * HEAP_INDEX_SIZE;
+    if (HeapTreeBefore(hole, node))
+        node->left = HeapTreeRemove(node->left, hole);
+    else
+        node->right = HeapTreeRemove(node->right, hole);
+
+    return HeapTreeBalance(node);
+}
+
+static void HeapInsertHole(Heap *heap, HeapHole *hole) {
+    uint64_t size = hole->header.size;
+    heap->free += size;
+    heap->holes++;
+
+    if (size < HEAP_SMALL_LIMIT) {
+        uint64_t index = HeapSmallClass(size);
+        hole->prev = 0;
+        hole->next = heap->small[index];
+        if (hole->next)
+            hole->next->prev = hole;
+        heap->small[index] = hole;
+        heap->small_map |= 1ull << index;
+        return;
+    }
+
+    hole->left = 0;
+    hole->right = 0;
+    hole->height = 1;
+    heap->large = HeapTreeInsert(heap->large, hole);
+}
+
+static void HeapRemoveHole(Heap *heap, HeapHole *hole) {
+    uint64_t size = hole->header.size;
+    heap->free -= size;
+    heap->holes--;
+
+    if (size >= HEAP_SMALL_LIMIT) {
+        heap->large = HeapTreeRemove(heap->large, hole);
+        return;
+    }
+
+    uint64_t index = HeapSmallClass(size);
+    if (hole->prev)
+        hole->prev->next = hole->next;
+    else
+        heap->small[index] = hole->next;
+    if (hole->next)
+        hole->next->prev = hole->prev;
+
+    if (!heap->small[index])
+        heap->small_map &= ~(1ull << index);
+}
+
+// Returns a hole of at least `size` bytes without taking it out of the index.
+static HeapHole *HeapFindHole(Heap *heap, uint64_t size) {
+    // Round up to the next list boundary, so that any block in the first non-empty list is large enough.
+    uint64_t rounded = size + (1ull << (HeapLog2(size) - HEAP_SUBCLASS_SHIFT)) - 1;
+    if (rounded < HEAP_SMALL_LIMIT) {
+        uint64_t map = heap->small_map & (~0ull << HeapSmallClass(rounded));
+        if (map)
+            return heap->small[__builtin_ctzll(map)];
+    }
+
+    HeapHole *best = 0;
+    for (HeapHole *node = heap->large; node;) {
+        if (node->header.size >= size) {
+            best = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
 
-    if ((start & 0xFFFFFFFFFFFFF000) != 0) {
+    return best;
+}
+
+// Extends the heap by `size` bytes and returns the hole at its end, merged with the hole that ended there before.
+static HeapHole *HeapGrow(Heap *heap, uint64_t size) {
+    uint64_t old_end = heap->end_address;
+    HeapHeader *block = (HeapHeader *) old_end;
+
+    HeapFooter *last = (HeapFooter *) (old_end - sizeof(HeapFooter));
+    if (last->magic == HEAP_MAGIC && last->header->is_hole)
+        block = last->header;
+
+    if (!HeapExpand(heap, old_end - heap->start_address + size))
+        return 0;
+
+    if (block != (HeapHeader *) old_end)
+        HeapRemoveHole(heap, (HeapHole *) block);
+
+    HeapSetBlock(block, heap->end_address - (uint64_t) block, 1);
+    HeapInsertHole(heap, (HeapHole *) block);
+    return (HeapHole *) block;
+}
+
+Heap *HeapCreate(uint64_t start, uint64_t end, uint64_t max, int8_t supervisor, int8_t readonly) {
+    Heap *heap = (Heap *) MmPhysToVirt((uint64_t) MmRequestZeroedPage());
+
+    if ((start & 0xFFF) != 0) {
         start &= 0xFFFFFFFFFFFFF000;
         start += 0x1000;
     }
@@ -93,106 +273,63 @@ Heap *HeapCreate(uint64_t start, uint64_t end, uint64_t max, int8_t supervisor,
     heap->readonly = readonly;
 
     HeapHeader *hole = (HeapHeader *) start;
-    hole->size = end - start;
-    hole->magic = HEAP_MAGIC;
-    hole->is_hole = 1;
-    ArrayInsert(&heap->index, (void *) hole);
+    HeapSetBlock(hole, end - start, 1);
+    HeapInsertHole(heap, (HeapHole *) hole);
 
     return heap;
 }
 
-void *HeapAllocate(Heap *heap, uint64_t size, int8_t page_align) {
-    uint64_t new_size = size + sizeof(HeapHeader) + sizeof(HeapFooter);
-    int64_t iterator = HeapFindSmallestHole(heap, new_size, page_align);
-
-    if (iterator == -1) {
-        uint64_t old_length = heap->end_address - heap->start_address;
-        uint64_t old_end_address = heap->end_address;
-
-        HeapExpand(heap, old_length + new_size);
-        uint64_t new_length = heap->end_address - heap->start_address;
-
-        iterator = 0;
-
-        int64_t idx = -1;
-        uint64_t value = 0x0;
-        while (iterator < heap->index.size) {
-            uint64_t tmp = (uint64_t) ArrayGet(&heap->index, iterator);
-            if (tmp > value) {
-                value = tmp;
-                idx = iterator;
-            }
-            iterator++;
-        }
+// The size of the block, including header and footer, that holds `size` bytes of payload.
+static uint64_t HeapBlockSize(uint64_t size) {
+    uint64_t need = HEAP_ALIGN_UP(size, HEAP_ALIGN) + sizeof(HeapHeader) + sizeof(HeapFooter);
+    return need < HEAP_MIN_BLOCK ? HEAP_MIN_BLOCK : need;
+}
 
-        if (idx == -1) {
-            HeapHeader *header = (HeapHeader *) old_end_address;
-            header->magic = HEAP_MAGIC;
-            header->size = new_length - old_length;
-            header->is_hole = 1;
-            HeapFooter *footer = (HeapFooter *) (old_end_address + header->size - sizeof(HeapFooter));
-            footer->magic = HEAP_MAGIC;
-            footer->header = header;
-            ArrayInsert(&heap->index, (void *) header);
-        } else {
-            HeapHeader *header = ArrayGet(&heap->index, idx);
-            header->size += new_length - old_length;
-            HeapFooter *footer = (HeapFooter *) ((uint64_t) header + header->size - sizeof(HeapFooter));
-            footer->header = header;
-            footer->magic = HEAP_MAGIC;
-        }
+void *HeapAllocate(Heap *heap, uint64_t size, int8_t page_align) {
+    uint64_t need = HeapBlockSize(size);
 
-        return HeapAllocate(heap, size, page_align);
-    }
+    // Page aligned blocks need room to split off whatever comes before the aligned payload as a hole of its own.
+    uint64_t search = page_align ? need + PAGE_SIZE + HEAP_MIN_BLOCK : need;
 
-    HeapHeader *orig_hole_header = (HeapHeader *) ArrayGet(&heap->index, iterator);
-    uint64_t orig_hole_pos = (uint64_t) orig_hole_header;
-    uint64_t orig_hole_size = orig_hole_header->size;
+    HeapHole *hole = HeapFindHole(heap, search);
+    if (!hole)
+        hole = HeapGrow(heap, search);
 
-    if (orig_hole_size - new_size < sizeof(HeapHeader) + sizeof(HeapFooter)) {
-        size += orig_hole_size - new_size;
-        new_size = orig_hole_size;
+    if (!hole) {
+        ComPrint("[HEAP] Out of memory allocating 0x%X bytes\n", size);
+        return 0;
     }
 
-    if (page_align && orig_hole_pos & 0xFFFFF000) {
-        uint64_t new_location = orig_hole_pos + PAGE_SIZE - (orig_hole_pos & 0xFFF) - sizeof(HeapHeader);
-        HeapHeader *hole_header = (HeapHeader *) orig_hole_pos;
-        hole_header->size = PAGE_SIZE - (orig_hole_pos & 0xFFF) - sizeof(HeapHeader);
-        hole_header->magic = HEAP_MAGIC;
-        hole_header->is_hole = 1;
-        HeapFooter *hole_footer = (HeapFooter *) ((uint64_t) new_location - sizeof(HeapFooter));
-        hole_footer->magic = HEAP_MAGIC;
-        hole_footer->header = hole_header;
-        orig_hole_pos = new_location;
-        orig_hole_size = orig_hole_size - hole_header->size;
-    } else {
-        ArrayRemove(&heap->index, iterator);
-    }
+    HeapRemoveHole(heap, hole);
 
+    HeapHeader *block = &hole->header;
+    uint64_t available = block->size;
 
-    HeapHeader *block_header = (HeapHeader *) orig_hole_pos;
-    block_header->magic = HEAP_MAGIC;
-    block_header->is_hole = 0;
-    block_header->size = new_size;
-
-    HeapFooter *block_footer = (HeapFooter *) (orig_hole_pos + sizeof(HeapHeader) + size);
-    block_footer->magic = HEAP_MAGIC;
-    block_footer->header = block_header;
-
-    if (orig_hole_size - new_size > 0) {
-        HeapHeader *hole_header = (HeapHeader *) (orig_hole_pos + sizeof(HeapHeader) + size + sizeof(HeapFooter));
-        hole_header->magic = HEAP_MAGIC;
-        hole_header->is_hole = 1;
-        hole_header->size = orig_hole_size - new_size;
-        HeapFooter *hole_footer = (HeapFooter *) ((uint64_t) hole_header + orig_hole_size - new_size - sizeof(HeapFooter));
-        if ((uint64_t) hole_footer < heap->end_address) {
-            hole_footer->magic = HEAP_MAGIC;
-            hole_footer->header = hole_header;
+    if (page_align) {
+        uint64_t payload = HEAP_ALIGN_UP((uint64_t) block + sizeof(HeapHeader), PAGE_SIZE);
+        uint64_t front = payload - sizeof(HeapHeader) - (uint64_t) block;
+        if (front && front < HEAP_MIN_BLOCK)
+            front += PAGE_SIZE;
+
+        if (front) {
+            HeapSetBlock(block, front, 1);
+            HeapInsertHole(heap, (HeapHole *) block);
+            block = (HeapHeader *) ((uint64_t) block + front);
+            available -= front;
         }
-        ArrayInsert(&heap->index, (void *) hole_header);
     }
 
-    return (void *) ((uint64_t) block_header + sizeof(HeapHeader));
+    if (available - need >= HEAP_MIN_BLOCK) {
+        HeapHeader *rest = (HeapHeader *) ((uint64_t) block + need);
+        HeapSetBlock(rest, available - need, 1);
+        HeapInsertHole(heap, (HeapHole *) rest);
+        available = need;
+    }
+
+    HeapSetBlock(block, available, 0);
+    heap->used += available;
+
+    return (void *) ((uint64_t) block + sizeof(HeapHeader));
 }
 
 void HeapFree(Heap *heap, void *address) {
@@ -200,70 +337,165 @@ void HeapFree(Heap *heap, void *address) {
         return;
 
     HeapHeader *header = (HeapHeader *) ((uint64_t) address - sizeof(HeapHeader));
-    HeapFooter *footer = (HeapFooter *) ((uint64_t) header + header->size - sizeof(HeapFooter));
+    if (header->magic != HEAP_MAGIC || header->is_hole || HEAP_FOOTER(header)->magic != HEAP_MAGIC) {
+        ComPrint("[HEAP] Freeing 0x%X which is not an allocated block\n", address);
+        return;
+    }
 
-    header->is_hole = 1;
+    heap->used -= header->size;
 
-    char do_add = 1;
+    // The footer in front and the header behind the block lead straight to its neighbours.
+    if ((uint64_t) header > heap->start_address) {
+        HeapFooter *left = (HeapFooter *) ((uint64_t) header - sizeof(HeapFooter));
+        if (left->magic == HEAP_MAGIC && left->header->is_hole) {
+            HeapRemoveHole(heap, (HeapHole *) left->header);
+            left->header->size += header->size;
+            header = left->header;
+        }
+    }
 
-    HeapFooter *test_footer = (HeapFooter *) ((uint64_t) header - sizeof(HeapFooter));
-    if (test_footer->magic == HEAP_MAGIC &&
-        test_footer->header->is_hole == 1) {
-        uint64_t cache_size = header->size;
-        header = test_footer->header;
-        footer->header = header;
-        header->size += cache_size;
-        do_add = 0;
+    HeapHeader *right = (HeapHeader *) ((uint64_t) header + header->size);
+    if ((uint64_t) right < heap->end_address && right->magic == HEAP_MAGIC && right->is_hole) {
+        HeapRemoveHole(heap, (HeapHole *) right);
+        header->size += right->size;
     }
 
-    HeapHeader *test_header = (HeapHeader *) ((uint64_t) footer + sizeof(HeapFooter));
-    if (test_header->magic == HEAP_MAGIC &&
-        test_header->is_hole) {
-        header->size += test_header->size;
-        test_footer = (HeapFooter *) ((uint64_t) test_header + test_header->size - sizeof(HeapFooter));
-        footer = test_footer;
-        uint64_t iterator = 0;
-        while ((iterator < heap->index.size) &&
-               (ArrayGet(&heap->index, iterator) != (void *) test_header))
-            iterator++;
-
-        ArrayRemove(&heap->index, iterator);
+    if ((uint64_t) header + header->size == heap->end_address && header->size >= HEAP_CONTRACT_SIZE) {
+        uint64_t length = HeapContract(heap, (uint64_t) header - heap->start_address + HEAP_MIN_BLOCK);
+        header->size = heap->start_address + length - (uint64_t) header;
     }
 
-    if ((uint64_t) footer + sizeof(HeapFooter) == heap->end_address) {
-        uint64_t old_length = heap->end_address - heap->start_address;
-        uint64_t new_length = HeapContract(heap, (uint64_t) header - heap->start_address);
-        if (header->size - (old_length - new_length) > 0) {
-            header->size -= old_length - new_length;
-            footer = (HeapFooter *) ((uint64_t) header + header->size - sizeof(HeapFooter));
-            footer->magic = HEAP_MAGIC;
-            footer->header = header;
-        } else {
-            uint64_t iterator = 0;
-            while ((iterator < heap->index.size) &&
-                   (ArrayGet(&heap->index, iterator) != (void *) test_header))
-                iterator++;
-            if (iterator < heap->index.size)
-                ArrayRemove(&heap->index, iterator);
-        }
+    HeapSetBlock(header, header->size, 1);
+    HeapInsertHole(heap, (HeapHole *) header);
+}
+
+// Resizes an allocated block without moving it, by giving back its tail or taking over the hole behind it. Returns
+// 0 when the block can't grow where it is.
+uint8_t HeapResize(Heap *heap, void *address, uint64_t size) {
+    HeapHeader *header = (HeapHeader *) ((uint64_t) address - sizeof(HeapHeader));
+    if (header->magic != HEAP_MAGIC || header->is_hole || HEAP_FOOTER(header)->magic != HEAP_MAGIC) {
+        ComPrint("[HEAP] Resizing 0x%X which is not an allocated block\n", address);
+        return 0;
     }
 
-    // If required, add us to the index.
-    if (do_add == 1)
-        ArrayInsert(&heap->index, (void *) header);
+    uint64_t need = HeapBlockSize(size);
+    uint64_t available = header->size;
+
+    HeapHeader *right = (HeapHeader *) ((uint64_t) header + header->size);
+    uint8_t right_hole = (uint64_t) right < heap->end_address && right->magic == HEAP_MAGIC && right->is_hole;
+    if (right_hole)
+        available += right->size;
+
+    // A block at the end of the heap grows by growing the heap, HeapGrow leaves a hole right behind it.
+    if (available < need && (uint64_t) header + available == heap->end_address) {
+        if (!HeapGrow(heap, need - available))
+            return 0;
+        right_hole = 1;
+        available = heap->end_address - (uint64_t) header;
+    }
+
+    if (available < need)
+        return 0;
+
+    if (right_hole)
+        HeapRemoveHole(heap, (HeapHole *) right);
+
+    heap->used -= header->size;
+    if (available - need >= HEAP_MIN_BLOCK) {
+        HeapHeader *rest = (HeapHeader *) ((uint64_t) header + need);
+        HeapSetBlock(rest, available - need, 1);
+        HeapInsertHole(heap, (HeapHole *) rest);
+        available = need;
+    }
+
+    HeapSetBlock(header, available, 0);
+    heap->used += available;
+    return 1;
 }
 
-void MmInitializeHeap(void) {
-    for (uint64_t offset = 0; offset < HEAP_SIZE; offset += PAGE_SIZE)
-        MmMapMemory((void *) (HEAP_ADDR + offset), MmRequestPage());
+static void *HeapMove(void *address, uint32_t size) {
+    void *moved = kmalloc(size);
+    if (!moved)
+        return 0;
 
-    kHeap = HeapCreate(HEAP_ADDR, HEAP_ADDR + HEAP_SIZE, HEAP_ADDR + 0x40000000, 0, 0);
+    uint64_t old_size = ksize(address);
+    RtCopyMemory(moved, address, old_size < size ? old_size : size);
+    kfree(address);
+    return moved;
 }
 
-void *kmalloc(uint32_t size) {
-    return HeapAllocate(kHeap, size, 0);
+void *krealloc(void *address, uint32_t size) {
+    if (address && !size) {
+        kfree(address);
+        return 0;
+    }
+
+    uint64_t location = (uint64_t) address;
+    void *resized = address;
+    if (!address) {
+        resized = kmalloc(size);
+    } else if (location >= kHeap->start_address && location < kHeap->max_address) {
+        uint64_t flags = IntelDisableInterrupts();
+        RtAcquireSpinlock(&kHeapLock);
+        uint8_t in_place = HeapResize(kHeap, address, size);
+        RtReleaseSpinlock(&kHeapLock);
+        IntelRestoreInterrupts(flags);
+
+        if (!in_place)
+            resized = HeapMove(address, size);
+    } else if (size > ksize(address)) {
+        // Small objects only move once they outgrow their class.
+        resized = HeapMove(address, size);
+    }
+
+#ifdef HEAP_PROFILE
+    // A new block was already counted by the kmalloc made on the caller's behalf, it only changes hands. A block
+    // that stayed put is recorded at its new size.
+    if (resized != address)
+        HeapProfileAttribute(resized, __builtin_return_address(0));
+    else
+        HeapProfileAllocate(resized, size, __builtin_return_address(0));
+#endif
+    return resized;
 }
 
-void kfree(void *address) {
-    HeapFree(kHeap, address);
+void HeapGetStatistics(Heap *heap, HeapStatistics *statistics) {
+    statistics->used = heap->used;
+    statistics->free = heap->free;
+    statistics->holes = heap->holes;
+    statistics->span = heap->end_address - heap->start_address;
+    statistics->largest_hole = 0;
+
+    HeapHole *node = heap->large;
+    while (node && node->right)
+        node = node->right;
+
+    if (node) {
+        statistics->largest_hole = node->header.size;
+    } else if (heap->small_map) {
+        for (HeapHole *hole = heap->small[HeapLog2(heap->small_map)]; hole; hole = hole->next) {
+            if (hole->header.size > statistics->largest_hole)
+                statistics->largest_hole = hole->header.size;
+        }
+    }
+}
+
+void MmInitializeHeap(void) {
+    // Only reserve the address space, the page-fault handler commits frames as the heap gets touched.
+    MmVma *area = MmAllocateVirtual(HEAP_MAX_SIZE, MM_LARGE_PAGE_SIZE, MM_VMA_LAZY);
+    if (!area) {
+        // Nothing past this point works without a heap.
+        ComPrint("[MM] No room for the 0x%X byte kernel heap in the VMA window, halting\n", (uint64_t) HEAP_MAX_SIZE);
+        while (1)
+            __asm__ volatile("cli; hlt");
+    }
+
+    MmRegisterLazyRegion((void *) area->start, HEAP_MAX_SIZE);
+
+    kHeap = HeapCreate(area->start, area->start + HEAP_SIZE, area->end, 0, 0);
+    MmInitializeKmalloc();
+
+#ifdef HEAP_PROFILE
+    HeapProfileInitialize();
+#endif
 }
@@ -1,13 +1,24 @@
 #pragma once
+#include "kmalloc.h"
 #include <stdint.h>
-#include <lib/array.h>
 
-#define HEAP_ADDR 0x0000100000000000
 #define HEAP_SIZE PAGE_SIZE * 65536
+#define HEAP_MAX_SIZE 0x40000000
 #define HEAP_MIN_SIZE 0x70000
-#define HEAP_INDEX_SIZE 0x20000
 #define HEAP_MAGIC 0x123890AB
 
+// Blocks are multiples of 16 bytes. Free blocks below HEAP_SMALL_LIMIT sit in segregated lists, eight per power of
+// two, larger ones in a tree ordered by size.
+#define HEAP_ALIGN 16
+#define HEAP_MIN_BLOCK 64
+#define HEAP_SMALL_LIMIT 0x1000
+#define HEAP_SUBCLASS_SHIFT 3
+#define HEAP_SMALL_CLASSES 48
+
+// A free block at the end of the heap is only given back once it is at least this large.
+#define HEAP_CONTRACT_SIZE 0x100000
+
+// Every block is framed by a header and a footer, so both neighbours of a block are found in constant time.
 typedef struct HeapHeader {
     uint32_t magic;
     uint8_t is_hole;
@@ -19,20 +30,55 @@ typedef struct HeapFooter {
     HeapHeader *header;
 } HeapFooter;
 
+// Free blocks keep their links in what would otherwise be the payload.
+typedef struct HeapHole {
+    HeapHeader header;
+    union {
+        struct {
+            struct HeapHole *next;
+            struct HeapHole *prev;
+        };
+        struct {
+            struct HeapHole *left;
+            struct HeapHole *right;
+        };
+    };
+    int64_t height;
+} HeapHole;
+
+typedef struct HeapStatistics {
+    uint64_t used;
+    uint64_t free;
+    uint64_t holes;
+    uint64_t largest_hole;
+    uint64_t span;
+} HeapStatistics;
+
 typedef struct Heap {
-    OrderedArray index;
+    HeapHole *small[HEAP_SMALL_CLASSES];
+    uint64_t small_map;
+    HeapHole *large;
+
     uint64_t start_address;
     uint64_t end_address;
     uint64_t max_address;
     uint8_t supervisor;
     uint8_t readonly;
+
+    uint64_t used;
+    uint64_t free;
+    uint64_t holes;
 } Heap;
 
 Heap *HeapCreate(uint64_t start, uint64_t end, uint64_t max, int8_t supervisor, int8_t readonly);
 void *HeapAllocate(Heap *heap, uint64_t size, int8_t page_align);
 void HeapFree(Heap *heap, void *p);
+uint8_t HeapResize(Heap *heap, void *address, uint64_t size);
+void HeapGetStatistics(Heap *heap, HeapStatistics *statistics);
 
 void MmInitializeHeap(void);
 
-void *kmalloc(uint32_t size);
-void kfree(void *address);
+extern Heap *kHeap;
+
+// kmalloc shares kHeap between CPUs, it is only safe to touch with this held.
+extern Spinlock kHeapLock;
@@ -0,0 +1,191 @@
+#include "kmalloc.h"
+#include "heap.h"
+#include "pmm.h"
+#include "profile.h"
+
+#include <cpu/intel.h>
+#include <utl/serial.h>
+
+#define KM_NEXT(object) (*(void **) (object))
+
+static const uint32_t kKmClassSizes[KM_SIZE_CLASSES] = {16, 32, 48, 64, 96, 128, 192, 256};
+
+static const char *kKmClassNames[KM_SIZE_CLASSES] = {
+        "kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64",
+        "kmalloc-96", "kmalloc-128", "kmalloc-192", "kmalloc-256",
+};
+
+// Maps a size rounded up to 16 bytes, divided by 16, to its class.
+static uint8_t kKmClassIndex[KM_SMALL_LIMIT / 16 + 1];
+
+static KmCpu kKmCpus[CPU_MAX];
+static uint8_t kKmReady = 0;
+
+void MmInitializeKmalloc(void) {
+    uint8_t class = 0;
+    for (uint32_t index = 0; index <= KM_SMALL_LIMIT / 16; index++) {
+        while (kKmClassSizes[class] < index * 16)
+            class++;
+        kKmClassIndex[index] = class;
+    }
+
+    // Every class slab is a single page, so kfree finds it by masking the address.
+    for (uint32_t cpu = 0; cpu < CPU_MAX; cpu++) {
+        for (class = 0; class < KM_SIZE_CLASSES; class++) {
+            KmCpuClass *cpu_class = &kKmCpus[cpu].classes[class];
+            KmCacheInitialize(&cpu_class->cache, kKmClassNames[class], kKmClassSizes[class], 16, 0);
+            cpu_class->cpu = cpu;
+        }
+    }
+
+    kKmReady = 1;
+}
+
+static void *KmHeapAllocate(uint32_t size) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kHeapLock);
+    void *address = HeapAllocate(kHeap, size, 0);
+    RtReleaseSpinlock(&kHeapLock);
+    IntelRestoreInterrupts(flags);
+    return address;
+}
+
+static void KmHeapFree(void *address) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kHeapLock);
+    HeapFree(kHeap, address);
+    RtReleaseSpinlock(&kHeapLock);
+    IntelRestoreInterrupts(flags);
+}
+
+// Called with interrupts disabled on the owning CPU once its freelist ran dry.
+static void KmRefill(KmCpu *cpu, KmCpuClass *class) {
+    // Objects other CPUs gave back are taken over as a whole.
+    void *remote = __atomic_exchange_n(&class->remote, 0, __ATOMIC_ACQUIRE);
+    if (remote) {
+        class->free = remote;
+        for (void *object = remote; object; object = KM_NEXT(object))
+            class->count++;
+        return;
+    }
+
+    for (uint64_t i = 0; i < KM_CPU_BATCH; i++) {
+        void *object = KmCacheAlloc(&class->cache);
+        if (!object)
+            break;
+
+        KM_NEXT(object) = class->free;
+        class->free = object;
+        class->count++;
+    }
+
+    cpu->statistics.refills++;
+}
+
+static void KmDrain(KmCpu *cpu, KmCpuClass *class) {
+    for (uint64_t i = 0; i < KM_CPU_BATCH && class->free; i++) {
+        void *object = class->free;
+        class->free = KM_NEXT(object);
+        class->count--;
+        KmCacheFree(&class->cache, object);
+    }
+
+    cpu->statistics.drains++;
+}
+
+void *kmalloc(uint32_t size) {
+    if (size > KM_SMALL_LIMIT || !kKmReady) {
+        if (kKmReady)
+            kKmCpus[CpuGetId()].statistics.heap_allocations++;
+
+        void *address = KmHeapAllocate(size);
+#ifdef HEAP_PROFILE
+        HeapProfileAllocate(address, size, __builtin_return_address(0));
+#endif
+        return address;
+    }
+
+    uint64_t flags = IntelDisableInterrupts();
+    KmCpu *cpu = &kKmCpus[CpuGetId()];
+    KmCpuClass *class = &cpu->classes[kKmClassIndex[(size + 15) / 16]];
+
+    if (!class->free)
+        KmRefill(cpu, class);
+
+    void *object = class->free;
+    if (object) {
+        class->free = KM_NEXT(object);
+        class->count--;
+        cpu->statistics.allocations++;
+    }
+
+    IntelRestoreInterrupts(flags);
+
+    if (!object)
+        ComPrint("[KMALLOC] Out of memory allocating %d bytes\n", size);
+
+#ifdef HEAP_PROFILE
+    HeapProfileAllocate(object, size, __builtin_return_address(0));
+#endif
+    return object;
+}
+
+void kfree(void *address) {
+    if (!address)
+        return;
+
+#ifdef HEAP_PROFILE
+    HeapProfileFree(address);
+#endif
+
+    uint64_t location = (uint64_t) address;
+    if (location >= kHeap->start_address && location < kHeap->max_address) {
+        KmHeapFree(address);
+        return;
+    }
+
+    KmSlab *slab = (KmSlab *) (location & ~((uint64_t) PAGE_SIZE - 1));
+    KmCpuClass *owner = (KmCpuClass *) slab->cache;
+    if (slab->magic != KM_SLAB_MAGIC || (uint64_t) owner < (uint64_t) kKmCpus ||
+        (uint64_t) owner >= (uint64_t) (kKmCpus + CPU_MAX)) {
+        ComPrint("[KMALLOC] Freeing 0x%X which was not returned by kmalloc\n", address);
+        return;
+    }
+
+    uint64_t flags = IntelDisableInterrupts();
+    KmCpu *cpu = &kKmCpus[CpuGetId()];
+
+    if (owner->cpu == CpuGetId()) {
+        KM_NEXT(address) = owner->free;
+        owner->free = address;
+        owner->count++;
+        cpu->statistics.frees++;
+
+        if (owner->count > KM_CPU_HIGH)
+            KmDrain(cpu, owner);
+    } else {
+        void *head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+        do {
+            KM_NEXT(address) = head;
+        } while (!__atomic_compare_exchange_n(&owner->remote, &head, address, 1, __ATOMIC_RELEASE,
+                                              __ATOMIC_RELAXED));
+        cpu->statistics.remote_frees++;
+    }
+
+    IntelRestoreInterrupts(flags);
+}
+
+uint64_t ksize(void *address) {
+    uint64_t location = (uint64_t) address;
+    if (location >= kHeap->start_address && location < kHeap->max_address) {
+        HeapHeader *header = (HeapHeader *) (location - sizeof(HeapHeader));
+        return header->size - sizeof(HeapHeader) - sizeof(HeapFooter);
+    }
+
+    KmSlab *slab = (KmSlab *) (location & ~((uint64_t) PAGE_SIZE - 1));
+    return slab->cache->object_size;
+}
+
+void KmGetCpuStatistics(uint32_t cpu, KmCpuStatistics *statistics) {
+    *statistics = kKmCpus[cpu].statistics;
+}
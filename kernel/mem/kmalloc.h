@@ -0,0 +1,48 @@
+#pragma once
+
+#include "slab.h"
+#include <cpu/percpu.h>
+#include <stdint.h>
+
+// Requests up to KM_SMALL_LIMIT bytes come from per-CPU size classes, everything larger from the heap.
+#define KM_SMALL_LIMIT 256
+#define KM_SIZE_CLASSES 8
+
+// A CPU refills an empty class with KM_CPU_BATCH objects from its own slabs and hands a batch back once more than
+// KM_CPU_HIGH objects pile up.
+#define KM_CPU_BATCH 32
+#define KM_CPU_HIGH 128
+
+// Each class owns the slabs its objects come from. The freelist is only touched by the owning CPU with interrupts
+// disabled, other CPUs push the objects they free onto the remote list without taking a lock.
+typedef struct __attribute__((aligned(KM_CACHE_LINE))) KmCpuClass {
+    KmCache cache;
+    void *free;
+    uint64_t count;
+    void *volatile remote;
+    uint32_t cpu;
+} KmCpuClass;
+
+typedef struct KmCpuStatistics {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t remote_frees;
+    uint64_t refills;
+    uint64_t drains;
+    uint64_t heap_allocations;
+} KmCpuStatistics;
+
+typedef struct KmCpu {
+    KmCpuClass classes[KM_SIZE_CLASSES];
+    KmCpuStatistics statistics;
+} KmCpu;
+
+void MmInitializeKmalloc(void);
+void KmGetCpuStatistics(uint32_t cpu, KmCpuStatistics *statistics);
+
+void *kmalloc(uint32_t size);
+void kfree(void *address);
+void *krealloc(void *address, uint32_t size);
+
+// The number of bytes usable behind an address kmalloc returned, at least as many as were asked for.
+uint64_t ksize(void *address);
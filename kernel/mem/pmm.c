@@ -1,139 +1,551 @@
 #include "pmm.h"
+#include "buddy.h"
 
+#include <cpu/intel.h>
+#include <cpu/percpu.h>
 #include <limine.h>
+#include <lib/lock.h>
 #include <lib/memory.h>
 #include <utl/serial.h>
 
 #define ALIGN_ADDR(x) (((PAGE_SIZE - 1) & (x)) ? ((x + PAGE_SIZE) & ~(PAGE_SIZE - 1)) : (x))
+#define ALIGN_DOWN(x) ((x) & ~(PAGE_SIZE - 1))
 #define IS_ALIGNED(x) ((((uint64_t) (x)) & (PAGE_SIZE - 1)) == 0)
 
-#define ADDR_TO_PAGE(x) ((uint64_t) (x) >> 12)
-
-#define SET_PAGE_BIT(x) (kMemory->bitfield[(x) >> 3] |= (1 << ((x) % 8)))
-#define CLEAR_PAGE_BIT(x) (kMemory->bitfield[(x) >> 3] &= ~(1 << ((x) % 8)))
-#define GET_PAGE_BIT(x) ((kMemory->bitfield[(x) >> 3] & (1 << ((x) % 8))) >> ((x) % 8))
+// Pages are numbered relative to the lowest usable page, addresses below it wrap around and fail the range check.
+#define ADDR_TO_PAGE(x) (((uint64_t) (x) >> 12) - (kMemory->first_available_page_addr >> 12))
+#define PAGE_TO_ADDR(x) (kMemory->first_available_page_addr + ((uint64_t) (x) << 12))
+#define PAGE_IN_RANGE(x) ((x) < kMemory->total_available_pages)
 
 MemoryStatistics *kMemory;
+uint64_t kHhdmOffset = 0;
+
+// Frames are handed out from small per-CPU stacks, so the global bitmap and its lock are only touched once per
+// refill or drain batch.
+typedef struct __attribute__((aligned(64))) MmPageCache {
+    uint64_t count;
+    uint64_t low;
+    uint64_t high;
+    MmPageCacheStatistics statistics;
+    void *pages[MM_PAGE_CACHE_SIZE];
+} MmPageCache;
+
+static Spinlock kMemoryLock = SPINLOCK_INIT;
+static MmPageCache kPageCaches[CPU_MAX];
+
+// Frames cleared ahead of time by the idle loop.
+static Spinlock kZeroPoolLock = SPINLOCK_INIT;
+static void *kZeroPool[MM_ZERO_POOL_SIZE];
+static uint64_t kZeroPoolCount = 0;
+static MmZeroPoolStatistics kZeroPoolStatistics;
 
 static volatile struct limine_memmap_request memmap_request = {
         .id = LIMINE_MEMMAP_REQUEST,
         .revision = 0,
 };
 
+static volatile struct limine_hhdm_request hhdm_request = {
+        .id = LIMINE_HHDM_REQUEST,
+        .revision = 0,
+};
+
+static uint64_t MmAcquireMemoryLock(void) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kMemoryLock);
+    return flags;
+}
+
+static void MmReleaseMemoryLock(uint64_t flags) {
+    RtReleaseSpinlock(&kMemoryLock);
+    IntelRestoreInterrupts(flags);
+}
+
+static int MmGetUsableRange(struct limine_memmap_entry *entry, uint64_t *base, uint64_t *end) {
+    if (entry->type != LIMINE_MEMMAP_USABLE)
+        return 0;
+
+    *base = ALIGN_ADDR(entry->base);
+    *end = ALIGN_DOWN(entry->base + entry->length);
+
+    return *base < *end;
+}
+
+static void MmMarkPageUsed(uint64_t page) {
+    uint64_t word = page >> 6;
+    BitmapSet(&kMemory->pages, page);
+    if (kMemory->pages.words[word] != ~0ull)
+        return;
+
+    uint64_t summary = word >> 6;
+    BitmapSet(&kMemory->summary, word);
+    if (kMemory->summary.words[summary] != ~0ull)
+        return;
+
+    BitmapSet(&kMemory->top, summary);
+}
+
+static void MmMarkPageFree(uint64_t page) {
+    uint64_t word = page >> 6;
+    BitmapClear(&kMemory->pages, page);
+    BitmapClear(&kMemory->summary, word);
+    BitmapClear(&kMemory->top, word >> 6);
+
+    if ((word >> 12) < kMemory->top_hint)
+        kMemory->top_hint = word >> 12;
+}
+
+// Range updates work on whole bitmap words and return how many pages actually changed state.
+static uint64_t MmMarkRangeUsed(uint64_t page, uint64_t end) {
+    uint64_t changed = 0;
+    for (uint64_t word = page >> 6; (word << 6) < end; word++) {
+        uint64_t mask = BitmapWordMask(word, page, end);
+        uint64_t old = kMemory->pages.words[word];
+        if (mask == ~0ull && !old)
+            changed += 64;
+        else
+            changed += BitmapCountBits(mask & ~old);
+
+        kMemory->pages.words[word] = old | mask;
+        if (old == ~0ull || (old | mask) != ~0ull)
+            continue;
+
+        BitmapSet(&kMemory->summary, word);
+        if (kMemory->summary.words[word >> 6] == ~0ull)
+            BitmapSet(&kMemory->top, word >> 6);
+    }
+
+    return changed;
+}
+
+static uint64_t MmMarkRangeFree(uint64_t page, uint64_t end) {
+    uint64_t changed = 0;
+    for (uint64_t word = page >> 6; (word << 6) < end; word++) {
+        uint64_t mask = BitmapWordMask(word, page, end);
+        uint64_t old = kMemory->pages.words[word];
+        if (mask == ~0ull && old == ~0ull)
+            changed += 64;
+        else
+            changed += BitmapCountBits(mask & old);
+
+        kMemory->pages.words[word] = old & ~mask;
+        BitmapClear(&kMemory->summary, word);
+        BitmapClear(&kMemory->top, word >> 6);
+    }
+
+    if (((page >> 6) >> 12) < kMemory->top_hint)
+        kMemory->top_hint = (page >> 6) >> 12;
+
+    return changed;
+}
+
+static int64_t MmFindFreePage(void) {
+    // Every top word below the hint is known to be full, so the scan usually stops at the first word.
+    int64_t summary = BitmapFindZero(&kMemory->top, kMemory->top_hint << 6, kMemory->top.bits);
+    if (summary < 0) {
+        kMemory->top_hint = BITMAP_WORDS(kMemory->top.bits);
+        return -1;
+    }
+
+    kMemory->top_hint = (uint64_t) summary >> 6;
+
+    uint64_t word = ((uint64_t) summary << 6) + __builtin_ctzll(~kMemory->summary.words[summary]);
+    return (int64_t) ((word << 6) + __builtin_ctzll(~kMemory->pages.words[word]));
+}
+
+static int64_t MmFindNextFreePage(uint64_t page) {
+    if (!PAGE_IN_RANGE(page))
+        return -1;
+
+    uint64_t word = page >> 6;
+    uint64_t free = ~kMemory->pages.words[word] & (~0ull << (page & 63));
+    if (free)
+        return (int64_t) ((word << 6) + __builtin_ctzll(free));
+
+    // Skip the full words using the summaries instead of touching every bitmap word.
+    int64_t next = BitmapFindZero(&kMemory->summary, word + 1, kMemory->summary.bits);
+    if (next < 0)
+        return -1;
+
+    return (int64_t) (((uint64_t) next << 6) + __builtin_ctzll(~kMemory->pages.words[next]));
+}
+
 int MmInitialize() {
-    uint64_t total_memory = 0, usable_memory = 0;
+    if (!hhdm_request.response) {
+        ComPrint("[MM]: The bootloader did not provide a direct map.\n");
+        return 0;
+    }
+
+    kHhdmOffset = hhdm_request.response->offset;
+    return MmInitializeMemoryMap(memmap_request.response);
+}
+
+int MmInitializeMemoryMap(struct limine_memmap_response *memmap) {
+    uint64_t total_memory = 0, usable_memory = 0, usable_regions = 0;
+    uint64_t first_available_address = ~0ull, last_available_address = 0;
 
-    struct limine_memmap_entry *largest = 0;
-    struct limine_memmap_response *memmap = memmap_request.response;
     for (uint64_t entry_index = 0; entry_index < memmap->entry_count; entry_index++) {
         struct limine_memmap_entry *entry = memmap->entries[entry_index];
         total_memory += entry->length;
-        if (entry->type != LIMINE_MEMMAP_USABLE)
+
+        uint64_t base, end;
+        if (!MmGetUsableRange(entry, &base, &end))
             continue;
 
-        usable_memory += entry->length;
+        usable_memory += end - base;
+        usable_regions++;
+
+        if (base < first_available_address)
+            first_available_address = base;
+        if (end > last_available_address)
+            last_available_address = end;
+    }
 
-        if (!largest || entry->length > largest->length)
-            largest = entry;
+    if (!usable_regions) {
+        ComPrint("[MM]: No usable memory regions.\n");
+        return 0;
     }
 
-    uint64_t first_available_address = ALIGN_ADDR(largest->base);
-    uint64_t last_available_address = ALIGN_ADDR(largest->base + largest->length);
     uint64_t available_pages = (last_available_address - first_available_address) >> 12;
-    uint64_t bitfield_entries = ((available_pages % 8) == 0) ? (available_pages >> 3) : (available_pages >> 3) + 1;
+    uint64_t page_words = BITMAP_WORDS(available_pages);
+    uint64_t summary_words = BITMAP_WORDS(page_words);
+    uint64_t top_words = BITMAP_WORDS(summary_words);
+
+    uint64_t bitmap_size = (page_words + summary_words + top_words) * sizeof(uint64_t);
+    uint64_t metadata_size = ALIGN_ADDR(ALIGN_ADDR(sizeof(MemoryStatistics)) + bitmap_size);
+
+    // The bitmaps live at the start of the first usable region that is large enough to hold them.
+    uint64_t metadata_address = 0;
+    for (uint64_t entry_index = 0; entry_index < memmap->entry_count && !metadata_address; entry_index++) {
+        uint64_t base, end;
+        if (MmGetUsableRange(memmap->entries[entry_index], &base, &end) && end - base >= metadata_size)
+            metadata_address = base;
+    }
 
-    if (largest->length < (bitfield_entries + sizeof(MemoryStatistics) + (3 << 12)))
+    if (!metadata_address) {
         ComPrint("[MM]: Not enough memory to fit the physical bitmap.\n");
+        return 0;
+    }
 
-    kMemory = (MemoryStatistics *) first_available_address;
-    kMemory->bitfield = (uint8_t *) ALIGN_ADDR(first_available_address + sizeof(MemoryStatistics));
+    kMemory = (MemoryStatistics *) MmPhysToVirt(metadata_address);
+    RtZeroMemory(kMemory, sizeof(MemoryStatistics));
 
-    RtZeroMemory(kMemory->bitfield, bitfield_entries);
+    // Each level covers its padding bits as well, they are marked used below so no search ever returns them.
+    uint64_t *words = (uint64_t *) MmPhysToVirt(ALIGN_ADDR(metadata_address + sizeof(MemoryStatistics)));
+    BitmapInitialize(&kMemory->pages, words, page_words << 6);
+    BitmapInitialize(&kMemory->summary, words + page_words, summary_words << 6);
+    BitmapInitialize(&kMemory->top, words + page_words + summary_words, top_words << 6);
 
     kMemory->total_available_pages = available_pages;
     kMemory->total_memory = total_memory;
     kMemory->total_pages = total_memory >> 12;
-
-    kMemory->free_memory = last_available_address - first_available_address;
-    kMemory->locked_memory = 0;
-    kMemory->reserved_memory = 0;
+    kMemory->usable_regions = usable_regions;
 
     kMemory->last_available_page_address = last_available_address;
     kMemory->first_available_page_addr = first_available_address;
 
-    if (!IS_ALIGNED(kMemory) || !IS_ALIGNED(kMemory->bitfield) || !IS_ALIGNED(kMemory->first_available_page_addr))
+    if (!IS_ALIGNED(kMemory) || !IS_ALIGNED(kMemory->pages.words) || !IS_ALIGNED(kMemory->first_available_page_addr))
         ComPrint("[MM]: Memory is not aligned.\n");
 
-    MmReservePages((void *) 0, (bitfield_entries + sizeof(MemoryStatistics) + (3 << 12)) >> 12);
+    // The summary padding is marked first, so a summary word that only fills up together with it still sets its top
+    // bit. Then the holes between the usable regions (the memory map is sorted) and the padding at the end are marked
+    // used, one range per region.
+    BitmapSetRange(&kMemory->summary, page_words, kMemory->summary.bits);
+    BitmapSetRange(&kMemory->top, summary_words, kMemory->top.bits);
+
+    uint64_t cursor = 0;
+    for (uint64_t entry_index = 0; entry_index < memmap->entry_count; entry_index++) {
+        uint64_t base, end;
+        if (!MmGetUsableRange(memmap->entries[entry_index], &base, &end))
+            continue;
+
+        if (ADDR_TO_PAGE(base) > cursor)
+            MmMarkRangeUsed(cursor, ADDR_TO_PAGE(base));
+        cursor = ADDR_TO_PAGE(end);
+    }
+
+    MmMarkRangeUsed(cursor, kMemory->pages.bits);
+    kMemory->top_hint = 0;
+
+    kMemory->free_memory = usable_memory;
+    kMemory->locked_memory = 0;
+    kMemory->reserved_memory = 0;
+
+    MmLockPages((void *) metadata_address, metadata_size >> 12);
+    MmSetPageCacheWatermarks(MM_PAGE_CACHE_LOW, MM_PAGE_CACHE_HIGH);
+
+    ComPrint("[MM] Managing %D usable regions (%D free pages).\n", usable_regions, kMemory->free_memory >> 12);
 
     return 1;
 }
 
-void MmReservePage(void *address) {
-    SET_PAGE_BIT(ADDR_TO_PAGE(address));
+struct limine_memmap_response *MmGetMemoryMap() {
+    return memmap_request.response;
+}
+
+static void MmSetPages(void *address, uint64_t pages, uint8_t used, uint8_t reserved) {
+    uint64_t first = ADDR_TO_PAGE(address), end = first + pages;
 
-    kMemory->free_memory -= PAGE_SIZE;
-    kMemory->reserved_memory += PAGE_SIZE;
+    // Clip the range to the bitmap, callers are allowed to pass firmware and MMIO ranges that lie outside of it.
+    if ((int64_t) first < 0) {
+        if ((int64_t) end <= 0)
+            return;
+        first = 0;
+    }
+    if (end > kMemory->total_available_pages)
+        end = kMemory->total_available_pages;
+    if (first >= end)
+        return;
+
+    uint64_t changed = (used ? MmMarkRangeUsed(first, end) : MmMarkRangeFree(first, end)) << 12;
+
+    if (used)
+        kMemory->free_memory -= changed;
+    else
+        kMemory->free_memory += changed;
+
+    if (reserved)
+        kMemory->reserved_memory += used ? changed : -changed;
+    else
+        kMemory->locked_memory += used ? changed : -changed;
 }
 
-void MmUnreservePage(void *address) {
-    CLEAR_PAGE_BIT(ADDR_TO_PAGE(address));
+static void MmRefillPageCache(MmPageCache *cache) {
+    uint64_t flags = MmAcquireMemoryLock();
+
+    uint64_t refilled = 0;
+    while (cache->count < cache->low) {
+        int64_t page = MmFindFreePage();
+        if (page < 0)
+            break;
+
+        MmMarkPageUsed(page);
+        cache->pages[cache->count++] = (void *) PAGE_TO_ADDR(page);
+        refilled++;
+    }
+
+    kMemory->free_memory -= refilled << 12;
+    kMemory->locked_memory += refilled << 12;
 
-    kMemory->free_memory += PAGE_SIZE;
-    kMemory->reserved_memory -= PAGE_SIZE;
+    MmReleaseMemoryLock(flags);
+
+    cache->statistics.refills++;
 }
 
-void MmLockPage(void *address) {
-    SET_PAGE_BIT(ADDR_TO_PAGE(address));
+static void MmDrainPageCache(MmPageCache *cache) {
+    uint64_t flags = MmAcquireMemoryLock();
+
+    uint64_t drained = 0;
+    while (cache->count > cache->low) {
+        MmMarkPageFree(ADDR_TO_PAGE(cache->pages[--cache->count]));
+        drained++;
+    }
+
+    kMemory->free_memory += drained << 12;
+    kMemory->locked_memory -= drained << 12;
+
+    MmReleaseMemoryLock(flags);
 
-    kMemory->free_memory -= PAGE_SIZE;
-    kMemory->locked_memory += PAGE_SIZE;
+    cache->statistics.drains++;
 }
 
-void MmUnlockPage(void *address) {
-    CLEAR_PAGE_BIT(ADDR_TO_PAGE(address));
+void MmSetPageCacheWatermarks(uint64_t low, uint64_t high) {
+    if (high > MM_PAGE_CACHE_SIZE)
+        high = MM_PAGE_CACHE_SIZE;
+    if (high < 2)
+        high = 2;
+    if (low >= high)
+        low = high / 2;
+    if (!low)
+        low = 1;
+
+    for (uint32_t cpu = 0; cpu < CPU_MAX; cpu++) {
+        kPageCaches[cpu].low = low;
+        kPageCaches[cpu].high = high;
+    }
+}
+
+void MmGetPageCacheStatistics(uint32_t cpu, MmPageCacheStatistics *statistics) {
+    if (cpu >= CPU_MAX)
+        return;
+
+    *statistics = kPageCaches[cpu].statistics;
+    statistics->cached = kPageCaches[cpu].count;
+}
+
+void MmReservePage(void *address) {
+    MmReservePages(address, 1);
+}
+
+void MmUnreservePage(void *address) {
+    MmUnreservePages(address, 1);
+}
+
+void MmLockPage(void *address) {
+    MmLockPages(address, 1);
+}
 
-    kMemory->free_memory += PAGE_SIZE;
-    kMemory->locked_memory -= PAGE_SIZE;
+void MmUnlockPage(void *address) {
+    MmUnlockPages(address, 1);
 }
 
 void MmReservePages(void *address, uint64_t pages) {
-    for (uint64_t i = 0; i < pages; i++)
-        MmReservePage((void *) ((uint64_t) address + (i << 12)));
+    uint64_t flags = MmAcquireMemoryLock();
+    MmSetPages(address, pages, 1, 1);
+    MmReleaseMemoryLock(flags);
 }
 
 void MmUnreservePages(void *address, uint64_t pages) {
-    for (uint64_t i = 0; i < pages; i++)
-        MmUnreservePage((void *) ((uint64_t) address + (i << 12)));
+    uint64_t flags = MmAcquireMemoryLock();
+    MmSetPages(address, pages, 0, 1);
+    MmReleaseMemoryLock(flags);
 }
 
 void MmLockPages(void *address, uint64_t pages) {
-    for (uint64_t i = 0; i < pages; i++)
-        MmLockPage((void *) ((uint64_t) address + (i << 12)));
+    uint64_t flags = MmAcquireMemoryLock();
+    MmSetPages(address, pages, 1, 0);
+    MmReleaseMemoryLock(flags);
 }
 
 void MmUnlockPages(void *address, uint64_t pages) {
-    for (uint64_t i = 0; i < pages; i++)
-        MmUnlockPage((void *) ((uint64_t) address + (i << 12)));
+    uint64_t flags = MmAcquireMemoryLock();
+    MmSetPages(address, pages, 0, 0);
+    MmReleaseMemoryLock(flags);
 }
 
-void *MmRequestPage() {
-    static uint64_t last_requested = 0;
-    uint64_t first = last_requested - 1;
+static void *MmTakeCachedPage(void) {
+    void *address = 0;
 
-    while (GET_PAGE_BIT(last_requested) == 1) {
-        if (last_requested >= kMemory->total_available_pages)
-            last_requested = 0;
-        if (last_requested == first)
-            ComPrint("[MM] No free pages available!\n");
-        last_requested++;
+    // Only the local cache is touched here, the global bitmap is visited once per refill batch.
+    uint64_t flags = IntelDisableInterrupts();
+    MmPageCache *cache = &kPageCaches[CpuGetId()];
+    if (!cache->count) {
+        cache->statistics.misses++;
+        MmRefillPageCache(cache);
     }
+    if (cache->count) {
+        address = cache->pages[--cache->count];
+        cache->statistics.allocations++;
+    }
+    IntelRestoreInterrupts(flags);
+
+    return address;
+}
+
+void *MmRequestPage() {
+    void *address = MmTakeCachedPage();
+
+    // The buddy allocator may still be holding on to split blocks, they go back to the bitmap for another try.
+    if (!address && MmReclaimBuddyPages())
+        address = MmTakeCachedPage();
 
-    MmLockPage((void *) (last_requested << 12));
+    if (!address)
+        ComPrint("[MM] No free pages available!\n");
 
-    return (void *) (kMemory->first_available_page_addr + (last_requested << 12));
+    return address;
 }
 
 void MmFreePage(void *addr) {
-    MmUnlockPage((void *) ((uint64_t)addr - kMemory->first_available_page_addr));
+    if (!PAGE_IN_RANGE(ADDR_TO_PAGE(addr)))
+        return;
+
+    uint64_t flags = IntelDisableInterrupts();
+    MmPageCache *cache = &kPageCaches[CpuGetId()];
+    cache->pages[cache->count++] = addr;
+    cache->statistics.frees++;
+    if (cache->count >= cache->high)
+        MmDrainPageCache(cache);
+    IntelRestoreInterrupts(flags);
+}
+
+void *MmRequestContiguousPages(uint64_t pages, uint64_t alignment) {
+    if (!pages || !alignment || (alignment & (alignment - 1)))
+        return 0;
+
+    // Alignment is in physical frame numbers, not relative to the first usable page.
+    uint64_t first_frame = kMemory->first_available_page_addr >> 12;
+    void *address = 0;
+
+    uint64_t flags = MmAcquireMemoryLock();
+
+    int64_t candidate = MmFindNextFreePage(0);
+    while (candidate >= 0) {
+        uint64_t page = ((first_frame + candidate + alignment - 1) & ~(alignment - 1)) - first_frame;
+        if (page + pages > kMemory->total_available_pages)
+            break;
+
+        int64_t used = BitmapFindSet(&kMemory->pages, page, page + pages);
+        if (used < 0) {
+            address = (void *) PAGE_TO_ADDR(page);
+            MmSetPages(address, pages, 1, 0);
+            break;
+        }
+
+        candidate = MmFindNextFreePage(used + 1);
+    }
+
+    MmReleaseMemoryLock(flags);
+
+    return address;
+}
+
+void *MmRequestZeroedPage() {
+    void *address = 0;
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kZeroPoolLock);
+    if (kZeroPoolCount) {
+        address = kZeroPool[--kZeroPoolCount];
+        kZeroPoolStatistics.hits++;
+    } else {
+        kZeroPoolStatistics.misses++;
+    }
+    RtReleaseSpinlock(&kZeroPoolLock);
+    IntelRestoreInterrupts(flags);
+
+    if (address)
+        return address;
+
+    // The pool ran dry, pay for the clear right here.
+    address = MmRequestPage();
+    if (address)
+        RtZeroMemory(MmPhysToVirt((uint64_t) address), PAGE_SIZE);
+
+    return address;
+}
+
+uint64_t MmRefillZeroedPages(uint64_t budget) {
+    uint64_t zeroed = 0;
+
+    while (zeroed < budget && kZeroPoolCount < MM_ZERO_POOL_SIZE) {
+        void *address = MmRequestPage();
+        if (!address)
+            break;
+
+        // Clear outside of the lock and with interrupts enabled, this is the expensive part.
+        RtZeroMemory(MmPhysToVirt((uint64_t) address), PAGE_SIZE);
+
+        uint64_t flags = IntelDisableInterrupts();
+        RtAcquireSpinlock(&kZeroPoolLock);
+        uint8_t stored = kZeroPoolCount < MM_ZERO_POOL_SIZE;
+        if (stored) {
+            kZeroPool[kZeroPoolCount++] = address;
+            kZeroPoolStatistics.zeroed++;
+        }
+        RtReleaseSpinlock(&kZeroPoolLock);
+        IntelRestoreInterrupts(flags);
+
+        if (!stored) {
+            MmFreePage(address);
+            break;
+        }
+
+        zeroed++;
+    }
+
+    return zeroed;
+}
+
+void MmGetZeroPoolStatistics(MmZeroPoolStatistics *statistics) {
+    *statistics = kZeroPoolStatistics;
+    statistics->pooled = kZeroPoolCount;
 }
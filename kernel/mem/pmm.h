@@ -2,23 +2,77 @@
 
 #include "stdint.h"
 
+#include <lib/bitmap.h>
+
 #define PAGE_SIZE 0x1000
 
-typedef struct __attribute__((packed)) {
+// Physical memory is accessed through the higher-half direct map Limine sets up at this offset.
+extern uint64_t kHhdmOffset;
+
+static inline void *MmPhysToVirt(uint64_t physical_address) {
+    return (void *) (physical_address + kHhdmOffset);
+}
+
+static inline uint64_t MmVirtToPhys(void *virtual_address) {
+    return (uint64_t) virtual_address - kHhdmOffset;
+}
+
+// The page bitmap is summarized twice: every summary bit covers one bitmap word (64 pages) and
+// every top bit covers one summary word (4096 pages). A set bit means "everything below is in use".
+typedef struct {
     uint64_t total_available_pages;
     uint64_t first_available_page_addr;
     uint64_t last_available_page_address;
     uint64_t total_memory;
     uint64_t total_pages;
-    uint8_t * bitfield;
+    uint64_t usable_regions;
+
+    Bitmap pages;
+    Bitmap summary;
+    Bitmap top;
+    uint64_t top_hint;
 
     uint64_t free_memory;
     uint64_t locked_memory;
     uint64_t reserved_memory;
 } MemoryStatistics;
 
+// Refills bring an empty per-CPU cache up to the low watermark, frees that push it to the high watermark drain
+// it back down to the low one. Frames sitting in a cache are accounted as locked.
+#define MM_PAGE_CACHE_SIZE 128
+#define MM_PAGE_CACHE_LOW 32
+#define MM_PAGE_CACHE_HIGH 96
+
+typedef struct MmPageCacheStatistics {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t drains;
+    uint64_t cached;
+} MmPageCacheStatistics;
+
+// Zeroed frames are prepared by the idle loop, MmRequestZeroedPage only clears synchronously when the pool is empty.
+#define MM_ZERO_POOL_SIZE 256
+#define MM_ZERO_POOL_BATCH 16
+
+typedef struct MmZeroPoolStatistics {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t zeroed;
+    uint64_t pooled;
+} MmZeroPoolStatistics;
+
+extern MemoryStatistics *kMemory;
+
+struct limine_memmap_response;
+
 int MmInitialize();
 
+// Builds the page bitmap from a memory map whose usable regions are reachable through kHhdmOffset.
+int MmInitializeMemoryMap(struct limine_memmap_response *memmap);
+struct limine_memmap_response *MmGetMemoryMap();
+
 void MmReservePage(void* address);
 void MmUnreservePage(void* address);
 
@@ -32,4 +86,13 @@ void MmLockPages(void* address, uint64_t pages);
 void MmUnlockPages(void* address, uint64_t pages);
 
 void* MmRequestPage();
-void MmFreePage(void* address);
\ No newline at end of file
+void MmFreePage(void* address);
+
+void* MmRequestContiguousPages(uint64_t pages, uint64_t alignment);
+
+void MmSetPageCacheWatermarks(uint64_t low, uint64_t high);
+void MmGetPageCacheStatistics(uint32_t cpu, MmPageCacheStatistics *statistics);
+
+void* MmRequestZeroedPage();
+uint64_t MmRefillZeroedPages(uint64_t budget);
+void MmGetZeroPoolStatistics(MmZeroPoolStatistics *statistics);
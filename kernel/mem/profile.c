@@ -0,0 +1,248 @@
+#include "profile.h"
+
+#ifdef HEAP_PROFILE
+
+#include "heap.h"
+#include "vma.h"
+
+#include <cpu/intel.h>
+#include <lib/lock.h>
+#include <utl/serial.h>
+
+#define HEAP_PROFILE_HASH(key) (((key) * 0x9E3779B97F4A7C15ull) >> 40)
+
+static Spinlock kProfileLock = SPINLOCK_INIT;
+static HeapProfileBlock *kProfileBlocks = 0;
+static HeapProfileSite kProfileSites[HEAP_PROFILE_SITES];
+
+static uint64_t kProfileStart = 0;
+static uint64_t kProfileLiveBytes = 0;
+static uint64_t kProfilePeakBytes = 0;
+static uint64_t kProfilePeakSpan = 0;
+static uint64_t kProfileDropped = 0;
+static uint64_t kProfileSizes[HEAP_PROFILE_SIZE_BUCKETS];
+static uint64_t kProfileEpochs[HEAP_PROFILE_EPOCHS];
+
+void HeapProfileInitialize(void) {
+    // The table comes from vmalloc, allocating it with kmalloc would record the profiler itself.
+    kProfileBlocks = (HeapProfileBlock *) vmalloc(HEAP_PROFILE_BLOCKS * sizeof(HeapProfileBlock));
+    if (!kProfileBlocks) {
+        ComPrint("[HEAP] Profiler disabled, no memory for its block table\n");
+        return;
+    }
+
+    for (uint64_t i = 0; i < HEAP_PROFILE_BLOCKS; i++)
+        kProfileBlocks[i].address = 0;
+
+    kProfileStart = IntelReadTsc();
+}
+
+// Both tables use linear probing, an empty slot ends every probe sequence.
+static HeapProfileBlock *HeapProfileFindBlock(uint64_t address, uint8_t insert) {
+    uint64_t index = HEAP_PROFILE_HASH(address) & (HEAP_PROFILE_BLOCKS - 1);
+    for (uint64_t probe = 0; probe < HEAP_PROFILE_BLOCKS; probe++) {
+        HeapProfileBlock *block = &kProfileBlocks[(index + probe) & (HEAP_PROFILE_BLOCKS - 1)];
+        if (block->address == address)
+            return block;
+        if (!block->address)
+            return insert ? block : 0;
+    }
+
+    return 0;
+}
+
+static HeapProfileSite *HeapProfileFindSite(uint64_t caller) {
+    uint64_t index = HEAP_PROFILE_HASH(caller) & (HEAP_PROFILE_SITES - 1);
+    for (uint64_t probe = 0; probe < HEAP_PROFILE_SITES; probe++) {
+        HeapProfileSite *site = &kProfileSites[(index + probe) & (HEAP_PROFILE_SITES - 1)];
+        if (site->caller == caller)
+            return site;
+        if (!site->caller) {
+            site->caller = caller;
+            return site;
+        }
+    }
+
+    return 0;
+}
+
+// Removes a block without leaving a hole in the probe sequence of the ones behind it.
+static void HeapProfileRemoveBlock(HeapProfileBlock *block) {
+    uint64_t hole = block - kProfileBlocks;
+    uint64_t index = hole;
+
+    while (1) {
+        index = (index + 1) & (HEAP_PROFILE_BLOCKS - 1);
+        HeapProfileBlock *next = &kProfileBlocks[index];
+        if (!next->address)
+            break;
+
+        uint64_t home = HEAP_PROFILE_HASH(next->address) & (HEAP_PROFILE_BLOCKS - 1);
+        if (((index - home) & (HEAP_PROFILE_BLOCKS - 1)) >= ((index - hole) & (HEAP_PROFILE_BLOCKS - 1))) {
+            kProfileBlocks[hole] = *next;
+            hole = index;
+        }
+    }
+
+    kProfileBlocks[hole].address = 0;
+}
+
+static void HeapProfileRelease(HeapProfileBlock *block) {
+    HeapProfileSite *site = &kProfileSites[block->site];
+    site->live_bytes -= block->size;
+    site->live_blocks--;
+    kProfileLiveBytes -= block->size;
+}
+
+void HeapProfileAllocate(void *address, uint64_t size, void *caller) {
+    if (!address || !kProfileBlocks)
+        return;
+
+    uint64_t now = IntelReadTsc() - kProfileStart;
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kProfileLock);
+
+    HeapProfileBlock *block = HeapProfileFindBlock((uint64_t) address, 1);
+    HeapProfileSite *site = HeapProfileFindSite((uint64_t) caller);
+    if (!block || !site) {
+        kProfileDropped++;
+        RtReleaseSpinlock(&kProfileLock);
+        IntelRestoreInterrupts(flags);
+        return;
+    }
+
+    if (block->address)
+        HeapProfileRelease(block);
+
+    block->address = (uint64_t) address;
+    block->size = size;
+    block->time = now >> HEAP_PROFILE_TIME_SHIFT;
+    block->site = site - kProfileSites;
+
+    site->live_bytes += size;
+    site->live_blocks++;
+    site->allocations++;
+    site->bytes += size;
+
+    kProfileLiveBytes += size;
+    if (kProfileLiveBytes > kProfilePeakBytes)
+        kProfilePeakBytes = kProfileLiveBytes;
+    if (kHeap->end_address - kHeap->start_address > kProfilePeakSpan)
+        kProfilePeakSpan = kHeap->end_address - kHeap->start_address;
+
+    uint64_t bucket = 63 - __builtin_clzll(size | 1);
+    kProfileSizes[bucket < HEAP_PROFILE_SIZE_BUCKETS ? bucket : HEAP_PROFILE_SIZE_BUCKETS - 1]++;
+
+    uint64_t epoch = now >> HEAP_PROFILE_EPOCH_SHIFT;
+    kProfileEpochs[epoch < HEAP_PROFILE_EPOCHS ? epoch : HEAP_PROFILE_EPOCHS - 1]++;
+
+    RtReleaseSpinlock(&kProfileLock);
+    IntelRestoreInterrupts(flags);
+}
+
+void HeapProfileAttribute(void *address, void *caller) {
+    if (!address || !kProfileBlocks)
+        return;
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kProfileLock);
+
+    HeapProfileBlock *block = HeapProfileFindBlock((uint64_t) address, 0);
+    HeapProfileSite *site = HeapProfileFindSite((uint64_t) caller);
+    if (block && site && site != &kProfileSites[block->site]) {
+        HeapProfileSite *previous = &kProfileSites[block->site];
+        previous->live_bytes -= block->size;
+        previous->live_blocks--;
+        previous->allocations--;
+        previous->bytes -= block->size;
+
+        site->live_bytes += block->size;
+        site->live_blocks++;
+        site->allocations++;
+        site->bytes += block->size;
+        block->site = site - kProfileSites;
+    }
+
+    RtReleaseSpinlock(&kProfileLock);
+    IntelRestoreInterrupts(flags);
+}
+
+void HeapProfileFree(void *address) {
+    if (!address || !kProfileBlocks)
+        return;
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kProfileLock);
+
+    HeapProfileBlock *block = HeapProfileFindBlock((uint64_t) address, 0);
+    if (block) {
+        HeapProfileRelease(block);
+        HeapProfileRemoveBlock(block);
+    }
+
+    RtReleaseSpinlock(&kProfileLock);
+    IntelRestoreInterrupts(flags);
+}
+
+void HeapProfilePrint(void) {
+    if (!kProfileBlocks)
+        return;
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kProfileLock);
+
+    ComPrint("[HEAP] Profile: %D bytes live, peak %D bytes live, peak heap span %D bytes, %D records dropped\n",
+             kProfileLiveBytes, kProfilePeakBytes, kProfilePeakSpan, kProfileDropped);
+
+    // Sites are listed by live bytes, largest first, each pass picks the largest one below the previous.
+    uint64_t previous_bytes = ~0ull;
+    uint64_t previous_index = 0;
+    ComPrint("[HEAP] Call sites by live bytes:\n");
+    for (uint64_t rank = 0; rank < HEAP_PROFILE_TOP; rank++) {
+        HeapProfileSite *best = 0;
+        for (uint64_t i = 0; i < HEAP_PROFILE_SITES; i++) {
+            HeapProfileSite *site = &kProfileSites[i];
+            if (!site->caller || !site->live_bytes)
+                continue;
+            if (site->live_bytes > previous_bytes || (site->live_bytes == previous_bytes && i <= previous_index))
+                continue;
+            if (!best || site->live_bytes > best->live_bytes)
+                best = site;
+        }
+
+        if (!best)
+            break;
+
+        previous_bytes = best->live_bytes;
+        previous_index = best - kProfileSites;
+
+        // The oldest live block of a site is the first thing to look at when hunting a leak.
+        uint32_t oldest = ~0u;
+        for (uint64_t i = 0; i < HEAP_PROFILE_BLOCKS; i++) {
+            HeapProfileBlock *block = &kProfileBlocks[i];
+            if (block->address && block->site == previous_index && block->time < oldest)
+                oldest = block->time;
+        }
+
+        ComPrint("[HEAP]    0x%X: %D bytes in %D blocks live, %D allocations of %D bytes, oldest from tick %D\n",
+                 best->caller, best->live_bytes, best->live_blocks, best->allocations, best->bytes,
+                 (uint64_t) oldest << HEAP_PROFILE_TIME_SHIFT);
+    }
+
+    ComPrint("[HEAP] Allocations by size:\n");
+    for (uint64_t bucket = 0; bucket < HEAP_PROFILE_SIZE_BUCKETS; bucket++) {
+        if (kProfileSizes[bucket])
+            ComPrint("[HEAP]    %D-%D bytes: %D\n", 1ull << bucket, (2ull << bucket) - 1, kProfileSizes[bucket]);
+    }
+
+    ComPrint("[HEAP] Allocations per 2^%d TSC ticks:\n", HEAP_PROFILE_EPOCH_SHIFT);
+    for (uint64_t epoch = 0; epoch < HEAP_PROFILE_EPOCHS; epoch++) {
+        if (kProfileEpochs[epoch])
+            ComPrint("[HEAP]    epoch %D: %D\n", epoch, kProfileEpochs[epoch]);
+    }
+
+    RtReleaseSpinlock(&kProfileLock);
+    IntelRestoreInterrupts(flags);
+}
+
+#endif
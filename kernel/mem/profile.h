@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+// Allocation-site profiling for kmalloc, compiled in with `make CPPFLAGS=-DHEAP_PROFILE`. Every live block is kept
+// in a side table together with the call site that asked for it, so the dump shows who holds the heap.
+
+#define HEAP_PROFILE_BLOCKS (1 << 17)
+#define HEAP_PROFILE_SITES 1024
+#define HEAP_PROFILE_TOP 16
+
+// Timestamps are TSC ticks since the profiler started, shifted right by HEAP_PROFILE_TIME_SHIFT to fit 32 bits.
+// The rate histogram counts allocations per epoch of 2^HEAP_PROFILE_EPOCH_SHIFT ticks.
+#define HEAP_PROFILE_TIME_SHIFT 16
+#define HEAP_PROFILE_EPOCH_SHIFT 32
+#define HEAP_PROFILE_EPOCHS 64
+#define HEAP_PROFILE_SIZE_BUCKETS 32
+
+typedef struct HeapProfileBlock {
+    uint64_t address;
+    uint32_t size;
+    uint32_t time;
+    uint32_t site;
+} HeapProfileBlock;
+
+typedef struct HeapProfileSite {
+    uint64_t caller;
+    uint64_t live_bytes;
+    uint64_t live_blocks;
+    uint64_t allocations;
+    uint64_t bytes;
+} HeapProfileSite;
+
+#ifdef HEAP_PROFILE
+
+void HeapProfileInitialize(void);
+
+// Records `address` as allocated by `caller`. A block that is already known moves to the new size and site, which
+// is how krealloc reports a resize in place.
+void HeapProfileAllocate(void *address, uint64_t size, void *caller);
+
+// Moves a block, together with the allocation it was counted as, over to `caller` without counting it again.
+void HeapProfileAttribute(void *address, void *caller);
+void HeapProfileFree(void *address);
+
+void HeapProfilePrint(void);
+
+#endif
@@ -0,0 +1,259 @@
+#include "slab.h"
+#include "buddy.h"
+#include "pmm.h"
+
+#include <cpu/intel.h>
+#include <utl/serial.h>
+
+#define KM_ALIGN_UP(value, alignment) (((value) + (alignment) - 1) & ~((uint64_t) (alignment) - 1))
+#define KM_SLAB_BYTES(order) ((uint64_t) PAGE_SIZE << (order))
+#define KM_LINK(cache, object) (*(void **) ((uint8_t *) (object) + (cache)->link_offset))
+
+static Spinlock kCachesLock = SPINLOCK_INIT;
+static LIST_HEAD(KmCache) kCaches = LIST_HEAD_INIT;
+
+// The cache descriptors come from a cache of their own.
+static KmCache kCacheCache;
+
+static uint8_t KmCacheSetup(KmCache *cache, const char *name, uint64_t size, uint64_t align, KmConstructor ctor) {
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+
+    // A constructed object has to stay intact while it is free, so its freelist link goes behind it instead.
+    uint64_t link_offset = ctor ? KM_ALIGN_UP(size, sizeof(void *)) : 0;
+    uint64_t stride = ctor ? link_offset + sizeof(void *) : size;
+    if (stride < sizeof(void *))
+        stride = sizeof(void *);
+    stride = KM_ALIGN_UP(stride, align);
+
+    uint64_t first_offset = KM_ALIGN_UP(sizeof(KmSlab), align);
+    uint64_t order = 0;
+    while (order < MM_BUDDY_MAX_ORDER && first_offset + KM_SLAB_MIN_OBJECTS * stride > KM_SLAB_BYTES(order))
+        order++;
+
+    if (first_offset + stride > KM_SLAB_BYTES(order)) {
+        ComPrint("[SLAB] %s: objects of 0x%X bytes don't fit in a slab\n", name, size);
+        return 0;
+    }
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->stride = stride;
+    cache->align = align;
+    cache->link_offset = link_offset;
+    cache->order = order;
+    cache->objects_per_slab = (KM_SLAB_BYTES(order) - first_offset) / stride;
+    cache->first_offset = first_offset;
+    cache->ctor = ctor;
+
+    cache->lock = (Spinlock) SPINLOCK_INIT;
+    LIST_INIT(&cache->partial);
+    LIST_INIT(&cache->full);
+    LIST_INIT(&cache->empty);
+
+    cache->slabs = 0;
+    cache->empty_slabs = 0;
+    cache->in_use = 0;
+    cache->allocations = 0;
+    cache->frees = 0;
+    return 1;
+}
+
+static KmSlab *KmSlabCreate(KmCache *cache) {
+    void *frame = MmRequestPages(cache->order);
+    if (!frame)
+        return 0;
+
+    KmSlab *slab = (KmSlab *) MmPhysToVirt((uint64_t) frame);
+    slab->magic = KM_SLAB_MAGIC;
+    slab->in_use = 0;
+    slab->cache = cache;
+    slab->free = 0;
+
+    // Thread the freelist backwards so objects are handed out in address order.
+    uint8_t *objects = (uint8_t *) slab + cache->first_offset;
+    for (uint64_t index = cache->objects_per_slab; index > 0; index--) {
+        void *object = objects + (index - 1) * cache->stride;
+        if (cache->ctor)
+            cache->ctor(object);
+        KM_LINK(cache, object) = slab->free;
+        slab->free = object;
+    }
+
+    return slab;
+}
+
+uint8_t KmCacheInitialize(KmCache *cache, const char *name, uint64_t size, uint64_t align, KmConstructor ctor) {
+    if (!KmCacheSetup(cache, name, size, align, ctor))
+        return 0;
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kCachesLock);
+    LIST_ADD(&kCaches, cache, list);
+    RtReleaseSpinlock(&kCachesLock);
+    IntelRestoreInterrupts(flags);
+
+    return 1;
+}
+
+KmCache *KmCacheCreate(const char *name, uint64_t size, uint64_t align, KmConstructor ctor) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kCachesLock);
+
+    if (!kCacheCache.name) {
+        KmCacheSetup(&kCacheCache, "KmCache", sizeof(KmCache), KM_CACHE_LINE, 0);
+        LIST_ADD(&kCaches, &kCacheCache, list);
+    }
+
+    RtReleaseSpinlock(&kCachesLock);
+    IntelRestoreInterrupts(flags);
+
+    KmCache *cache = (KmCache *) KmCacheAlloc(&kCacheCache);
+    if (!cache)
+        return 0;
+
+    if (!KmCacheInitialize(cache, name, size, align, ctor)) {
+        KmCacheFree(&kCacheCache, cache);
+        return 0;
+    }
+
+    return cache;
+}
+
+void *KmCacheAlloc(KmCache *cache) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&cache->lock);
+
+    KmSlab *slab = cache->partial.first;
+    if (!slab && cache->empty.first) {
+        slab = cache->empty.first;
+        LIST_REMOVE(&cache->empty, slab, list);
+        LIST_ADD(&cache->partial, slab, list);
+        cache->empty_slabs--;
+    }
+
+    if (!slab) {
+        // Constructors run without the lock held, they are free to allocate themselves.
+        RtReleaseSpinlock(&cache->lock);
+        IntelRestoreInterrupts(flags);
+
+        slab = KmSlabCreate(cache);
+        if (!slab) {
+            ComPrint("[SLAB] %s: out of memory\n", cache->name);
+            return 0;
+        }
+
+        flags = IntelDisableInterrupts();
+        RtAcquireSpinlock(&cache->lock);
+        LIST_ADD(&cache->partial, slab, list);
+        cache->slabs++;
+    }
+
+    void *object = slab->free;
+    slab->free = KM_LINK(cache, object);
+    slab->in_use++;
+
+    if (slab->in_use == cache->objects_per_slab) {
+        LIST_REMOVE(&cache->partial, slab, list);
+        LIST_ADD(&cache->full, slab, list);
+    }
+
+    cache->in_use++;
+    cache->allocations++;
+
+    RtReleaseSpinlock(&cache->lock);
+    IntelRestoreInterrupts(flags);
+    return object;
+}
+
+void KmCacheFree(KmCache *cache, void *object) {
+    if (!object)
+        return;
+
+    KmSlab *slab = (KmSlab *) ((uint64_t) object & ~(KM_SLAB_BYTES(cache->order) - 1));
+    if (slab->magic != KM_SLAB_MAGIC || slab->cache != cache) {
+        ComPrint("[SLAB] %s: freeing 0x%X which is not one of its objects\n", cache->name, object);
+        return;
+    }
+
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&cache->lock);
+
+    if (slab->in_use == cache->objects_per_slab) {
+        LIST_REMOVE(&cache->full, slab, list);
+        LIST_ADD(&cache->partial, slab, list);
+    }
+
+    KM_LINK(cache, object) = slab->free;
+    slab->free = object;
+    slab->in_use--;
+
+    cache->in_use--;
+    cache->frees++;
+
+    KmSlab *release = 0;
+    if (!slab->in_use) {
+        LIST_REMOVE(&cache->partial, slab, list);
+        if (cache->empty_slabs < KM_CACHE_MAX_EMPTY) {
+            LIST_ADD(&cache->empty, slab, list);
+            cache->empty_slabs++;
+        } else {
+            release = slab;
+            cache->slabs--;
+        }
+    }
+
+    RtReleaseSpinlock(&cache->lock);
+    IntelRestoreInterrupts(flags);
+
+    if (release) {
+        release->magic = 0;
+        MmFreePages((void *) MmVirtToPhys(release), cache->order);
+    }
+}
+
+void KmCacheGetStatistics(KmCache *cache, KmCacheStatistics *statistics) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&cache->lock);
+
+    statistics->object_size = cache->object_size;
+    statistics->stride = cache->stride;
+    statistics->objects_per_slab = cache->objects_per_slab;
+    statistics->slabs = cache->slabs;
+    statistics->empty = cache->empty_slabs;
+    statistics->in_use = cache->in_use;
+    statistics->allocations = cache->allocations;
+    statistics->frees = cache->frees;
+
+    statistics->partial = 0;
+    statistics->full = 0;
+    KmSlab *slab = 0;
+    LIST_FOREACH(slab, &cache->partial, list) {
+        statistics->partial++;
+    }
+    LIST_FOREACH(slab, &cache->full, list) {
+        statistics->full++;
+    }
+
+    RtReleaseSpinlock(&cache->lock);
+    IntelRestoreInterrupts(flags);
+}
+
+void KmPrintCaches(void) {
+    ComPrint("[SLAB] Caches:\n");
+
+    // Caches that never allocated a slab, like the per-CPU kmalloc classes of idle cores, are left out.
+    KmCache *cache = 0;
+    LIST_FOREACH(cache, &kCaches, list) {
+        KmCacheStatistics statistics;
+        KmCacheGetStatistics(cache, &statistics);
+        if (!statistics.slabs)
+            continue;
+
+        uint64_t capacity = statistics.slabs * statistics.objects_per_slab;
+        ComPrint("[SLAB]    %s: %D/%D objects of %D bytes (%D%%), %D slabs (%D partial, %D full, %D empty)\n",
+                 cache->name, statistics.in_use, capacity, statistics.object_size,
+                 capacity ? statistics.in_use * 100 / capacity : 0, statistics.slabs, statistics.partial,
+                 statistics.full, statistics.empty);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <lib/list.h>
+#include <lib/lock.h>
+#include <stdint.h>
+
+#define KM_CACHE_LINE 64
+
+// Slabs are sized to hold at least this many objects, up to the largest buddy block.
+#define KM_SLAB_MIN_OBJECTS 8
+
+// At most this many completely free slabs are kept per cache, the rest go back to the buddy allocator.
+#define KM_CACHE_MAX_EMPTY 1
+
+#define KM_SLAB_MAGIC 0x51AB51AB
+
+typedef void (*KmConstructor)(void *object);
+
+struct KmCache;
+
+// Every slab is a naturally aligned buddy block that starts with this header, so the slab an object belongs to is
+// found by masking its address.
+typedef struct KmSlab {
+    uint32_t magic;
+    uint32_t in_use;
+    struct KmCache *cache;
+    void *free;
+    LIST_ENTRY(struct KmSlab) list;
+} KmSlab;
+
+typedef LIST_HEAD(KmSlab) KmSlabList;
+
+typedef struct KmCacheStatistics {
+    uint64_t object_size;
+    uint64_t stride;
+    uint64_t objects_per_slab;
+    uint64_t slabs;
+    uint64_t partial;
+    uint64_t full;
+    uint64_t empty;
+    uint64_t in_use;
+    uint64_t allocations;
+    uint64_t frees;
+} KmCacheStatistics;
+
+typedef struct KmCache {
+    const char *name;
+    uint64_t object_size;
+    uint64_t stride;
+    uint64_t align;
+    uint64_t link_offset;
+    uint64_t order;
+    uint64_t objects_per_slab;
+    uint64_t first_offset;
+    KmConstructor ctor;
+
+    Spinlock lock;
+    KmSlabList partial;
+    KmSlabList full;
+    KmSlabList empty;
+
+    uint64_t slabs;
+    uint64_t empty_slabs;
+    uint64_t in_use;
+    uint64_t allocations;
+    uint64_t frees;
+
+    LIST_ENTRY(struct KmCache) list;
+} KmCache;
+
+uint8_t KmCacheInitialize(KmCache *cache, const char *name, uint64_t size, uint64_t align, KmConstructor ctor);
+KmCache *KmCacheCreate(const char *name, uint64_t size, uint64_t align, KmConstructor ctor);
+void *KmCacheAlloc(KmCache *cache);
+void KmCacheFree(KmCache *cache, void *object);
+
+void KmCacheGetStatistics(KmCache *cache, KmCacheStatistics *statistics);
+void KmPrintCaches(void);
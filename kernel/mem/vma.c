@@ -0,0 +1,258 @@
+#include "vma.h"
+#include "buddy.h"
+#include "vmm.h"
+
+#include <cpu/intel.h>
+#include <lib/lock.h>
+#include <utl/serial.h>
+
+#define MM_VMA_ALIGN(address, alignment) (((address) + (alignment) - 1) & ~((uint64_t) (alignment) - 1))
+#define MM_VMA_MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MM_VMA(rb) RB_CONTAINER(rb, MmVma, node)
+
+static void MmVmaUpdate(RbNode *node);
+
+static Spinlock kVmaLock = SPINLOCK_INIT;
+static RbTree kVmaTree = RB_TREE_INIT_AUGMENTED(MmVmaUpdate);
+static RbNode *kVmaFreeNodes = 0;
+static uint64_t kVmaAreas = 0;
+static uint64_t kVmaReserved = 0;
+
+// Nodes are carved out of whole pages so the allocator works before the heap exists, the heap itself lives in it.
+static MmVma *MmVmaAllocateNode(void) {
+    if (!kVmaFreeNodes) {
+        void *page = MmRequestZeroedPage();
+        if (!page)
+            return 0;
+
+        MmVma *nodes = (MmVma *) MmPhysToVirt((uint64_t) page);
+        for (uint64_t i = 0; i < PAGE_SIZE / sizeof(MmVma); i++) {
+            nodes[i].node.parent = kVmaFreeNodes;
+            kVmaFreeNodes = &nodes[i].node;
+        }
+    }
+
+    RbNode *node = kVmaFreeNodes;
+    kVmaFreeNodes = node->parent;
+    return MM_VMA(node);
+}
+
+static void MmVmaFreeNode(MmVma *area) {
+    area->node.parent = kVmaFreeNodes;
+    kVmaFreeNodes = &area->node;
+}
+
+static void MmVmaUpdate(RbNode *node) {
+    MmVma *area = MM_VMA(node);
+    MmVma *left = MM_VMA(node->left);
+    MmVma *right = MM_VMA(node->right);
+
+    area->min_start = left ? left->min_start : area->start;
+    area->max_end = right ? right->max_end : area->end;
+
+    uint64_t gap = 0;
+    if (left)
+        gap = MM_VMA_MAX(left->max_gap, area->start - left->max_end);
+    if (right)
+        gap = MM_VMA_MAX(gap, MM_VMA_MAX(right->max_gap, right->min_start - area->end));
+    area->max_gap = gap;
+}
+
+static int MmVmaCompare(RbNode *a, RbNode *b) {
+    return MM_VMA(a)->start < MM_VMA(b)->start ? -1 : MM_VMA(a)->start > MM_VMA(b)->start;
+}
+
+// An address compares equal to the area that contains it.
+static int MmVmaCompareAddress(RbNode *node, void *key) {
+    MmVma *area = MM_VMA(node);
+    uint64_t address = (uint64_t) key;
+    if (area->end <= address)
+        return -1;
+    return area->start > address;
+}
+
+// Finds the lowest aligned start of `size` free bytes in [low, high), where `node` holds every area in that range.
+// Subtrees whose largest hole is too small are never entered.
+static uint64_t MmVmaFindGap(MmVma *node, uint64_t low, uint64_t high, uint64_t size, uint64_t alignment) {
+    if (!node) {
+        uint64_t start = MM_VMA_ALIGN(low, alignment);
+        return start < high && high - start >= size ? start : 0;
+    }
+
+    uint64_t largest = MM_VMA_MAX(node->max_gap, MM_VMA_MAX(node->min_start - low, high - node->max_end));
+    if (largest < size)
+        return 0;
+
+    uint64_t start = MmVmaFindGap(MM_VMA(node->node.left), low, node->start, size, alignment);
+    if (start)
+        return start;
+
+    return MmVmaFindGap(MM_VMA(node->node.right), node->end, high, size, alignment);
+}
+
+MmVma *MmAllocateVirtual(uint64_t size, uint64_t alignment, uint64_t flags) {
+    size = MM_VMA_ALIGN(size, PAGE_SIZE);
+    if (alignment < PAGE_SIZE)
+        alignment = PAGE_SIZE;
+
+    uint64_t interrupts = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kVmaLock);
+
+    MmVma *area = 0;
+    uint64_t start = size ? MmVmaFindGap(MM_VMA(kVmaTree.root), MM_VMA_BASE, MM_VMA_END, size, alignment) : 0;
+    if (start && (area = MmVmaAllocateNode())) {
+        area->start = start;
+        area->end = start + size;
+        area->flags = flags;
+
+        RB_INSERT(&kVmaTree, area, MmVmaCompare, node);
+        kVmaAreas++;
+        kVmaReserved += size;
+    }
+
+    RtReleaseSpinlock(&kVmaLock);
+    IntelRestoreInterrupts(interrupts);
+
+    if (!area)
+        ComPrint("[MM] Out of kernel address space for 0x%X bytes\n", size);
+
+    return area;
+}
+
+void MmFreeVirtual(MmVma *area) {
+    uint64_t interrupts = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kVmaLock);
+
+    RB_REMOVE(&kVmaTree, area, node);
+    kVmaAreas--;
+    kVmaReserved -= area->end - area->start;
+    MmVmaFreeNode(area);
+
+    RtReleaseSpinlock(&kVmaLock);
+    IntelRestoreInterrupts(interrupts);
+}
+
+MmVma *MmFindVirtual(uint64_t address) {
+    uint64_t interrupts = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kVmaLock);
+
+    MmVma *area = RB_FIND(&kVmaTree, (void *) address, MmVmaCompareAddress, MmVma, node);
+
+    RtReleaseSpinlock(&kVmaLock);
+    IntelRestoreInterrupts(interrupts);
+    return area;
+}
+
+void MmGetVmaStatistics(MmVmaStatistics *statistics) {
+    uint64_t interrupts = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kVmaLock);
+
+    statistics->areas = kVmaAreas;
+    statistics->reserved = kVmaReserved;
+    statistics->largest_gap = MM_VMA_END - MM_VMA_BASE;
+    MmVma *root = MM_VMA(kVmaTree.root);
+    if (root)
+        statistics->largest_gap =
+                MM_VMA_MAX(root->max_gap, MM_VMA_MAX(root->min_start - MM_VMA_BASE, MM_VMA_END - root->max_end));
+
+    RtReleaseSpinlock(&kVmaLock);
+    IntelRestoreInterrupts(interrupts);
+}
+
+void *vmalloc(uint64_t size) {
+    size = MM_VMA_ALIGN(size, PAGE_SIZE);
+    if (!size)
+        return 0;
+
+    // Large allocations start on a 2 MiB boundary so they can be backed by large pages where the PMM has them.
+    // One more page is reserved and left unmapped as a guard against overruns.
+    uint64_t alignment = size >= MM_LARGE_PAGE_SIZE ? MM_LARGE_PAGE_SIZE : PAGE_SIZE;
+    MmVma *area = MmAllocateVirtual(size + PAGE_SIZE, alignment, MM_VMA_VMALLOC);
+    if (!area)
+        return 0;
+
+    // The frames don't have to be contiguous, every block is mapped on its own.
+    uint64_t mapped = 0;
+    while (mapped < size) {
+        uint64_t address = area->start + mapped;
+        uint64_t block = PAGE_SIZE;
+        void *frame = 0;
+
+        if (size - mapped >= MM_LARGE_PAGE_SIZE && !(address & (MM_LARGE_PAGE_SIZE - 1))) {
+            frame = MmRequestPages(MmGetPageOrder(MM_LARGE_PAGE_SIZE / PAGE_SIZE));
+            block = MM_LARGE_PAGE_SIZE;
+        }
+
+        if (!frame) {
+            frame = MmRequestPage();
+            block = PAGE_SIZE;
+        }
+
+        if (!frame) {
+            ComPrint("[MM] vmalloc of 0x%X bytes ran out of memory\n", size);
+            if (!MmUnmapRange((void *) area->start, mapped, 1))
+                MmFreeVirtual(area);
+            return 0;
+        }
+
+        MmMapRange((void *) address, frame, block, MM_MEMORY_WB);
+        mapped += block;
+    }
+
+    return (void *) area->start;
+}
+
+void vfree(void *address) {
+    if (!address)
+        return;
+
+    MmVma *area = MmFindVirtual((uint64_t) address);
+    if (!area || area->start != (uint64_t) address || !(area->flags & MM_VMA_VMALLOC)) {
+        ComPrint("[MM] vfree of 0x%X which was not returned by vmalloc\n", address);
+        return;
+    }
+
+    // A range that can't be unmapped right now keeps its address space too, reusing it would alias the old frames.
+    if (MmUnmapRange((void *) area->start, area->end - area->start - PAGE_SIZE, 1)) {
+        ComPrint("[MM] vfree of 0x%X while other cores are running, the memory is kept\n", address);
+        return;
+    }
+
+    MmFreeVirtual(area);
+}
+
+void *ioremap(uint64_t physical_address, uint64_t size, uint8_t type) {
+    uint64_t base = physical_address & 0xfffffffffffff000;
+    uint64_t length = MM_VMA_ALIGN(physical_address + size, PAGE_SIZE) - base;
+
+    // Big apertures are placed at the same offset within a 2 MiB page as their physical address, which lets
+    // MmMapRange use large pages for everything past the first boundary.
+    uint64_t slack = 0;
+    uint64_t alignment = PAGE_SIZE;
+    if (length >= MM_LARGE_PAGE_SIZE) {
+        slack = base & (MM_LARGE_PAGE_SIZE - 1);
+        alignment = MM_LARGE_PAGE_SIZE;
+    }
+
+    MmVma *area = MmAllocateVirtual(slack + length, alignment, MM_VMA_IOREMAP);
+    if (!area)
+        return 0;
+
+    MmMapRange((void *) (area->start + slack), (void *) base, length, type);
+    return (void *) (area->start + slack + (physical_address & 0xfff));
+}
+
+void iounmap(void *address) {
+    MmVma *area = MmFindVirtual((uint64_t) address);
+    if (!area || !(area->flags & MM_VMA_IOREMAP)) {
+        ComPrint("[MM] iounmap of 0x%X which was not returned by ioremap\n", address);
+        return;
+    }
+
+    if (MmUnmapRange((void *) area->start, area->end - area->start, 0)) {
+        ComPrint("[MM] iounmap of 0x%X while other cores are running, the mapping is kept\n", address);
+        return;
+    }
+
+    MmFreeVirtual(area);
+}
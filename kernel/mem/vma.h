@@ -0,0 +1,45 @@
+#pragma once
+
+#include "vmm.h"
+#include <lib/rbtree.h>
+#include <stdint.h>
+
+// Kernel virtual memory outside the direct map and the kernel image is handed out from this window.
+#define MM_VMA_BASE 0xffffc00000000000
+#define MM_VMA_END 0xffffe00000000000
+
+#define MM_VMA_LAZY 0x1
+#define MM_VMA_VMALLOC 0x2
+#define MM_VMA_IOREMAP 0x4
+
+// Areas are kept in a red-black tree ordered by start address. Every node also caches the lowest start, the highest
+// end and the largest hole between two areas in its subtree, so whole subtrees without a big enough hole are
+// skipped while searching.
+typedef struct MmVma {
+    uint64_t start;
+    uint64_t end;
+    uint64_t flags;
+
+    RbNode node;
+
+    uint64_t min_start;
+    uint64_t max_end;
+    uint64_t max_gap;
+} MmVma;
+
+typedef struct MmVmaStatistics {
+    uint64_t areas;
+    uint64_t reserved;
+    uint64_t largest_gap;
+} MmVmaStatistics;
+
+MmVma *MmAllocateVirtual(uint64_t size, uint64_t alignment, uint64_t flags);
+void MmFreeVirtual(MmVma *area);
+MmVma *MmFindVirtual(uint64_t address);
+void MmGetVmaStatistics(MmVmaStatistics *statistics);
+
+void *vmalloc(uint64_t size);
+void vfree(void *address);
+
+void *ioremap(uint64_t physical_address, uint64_t size, uint8_t type);
+void iounmap(void *address);
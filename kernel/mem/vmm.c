@@ -1,31 +1,246 @@
 #include "vmm.h"
+#include "buddy.h"
 
 #include <cpu/intel.h>
+#include <limine.h>
+#include <lib/lock.h>
 #include <lib/memory.h>
 #include <utl/serial.h>
 
+// Rounds up to the next multiple of `size`, an already aligned address moves on to the following one.
+#define MM_ALIGN_NEXT(address, size) (((address) + (size)) & ~((uint64_t) (size) - 1))
+
+// Range operations touching more pages than this flush the whole TLB instead of issuing invlpg for each page.
+#define MM_FLUSH_PAGE_LIMIT 32
+
+// MmUnmapRange holds on to at most this many freed frames and tables before it flushes and hands them back.
+#define MM_UNMAP_BATCH 64
+
+// Everything mapped through kPML4 belongs to the kernel and is shared by every address space, so leaf entries are
+// created global.
+#define CR4_PGE (1 << 7)
+#define CR4_PCIDE (1 << 17)
+#define CR3_NO_FLUSH (1ull << 63)
+#define MM_PCID_COUNT 4096
+
+typedef struct MmPcidState {
+    uint64_t generation;
+    uint64_t next;
+    MmAddressSpace *current;
+} MmPcidState;
+
+// Every PAT entry in the upper half mirrors the lower one: WB, WC, UC-, UC.
+#define IA32_PAT 0x277
+#define MM_PAT_LAYOUT 0x0007010600070106
+
+// Page tables are reached through the direct map, the entries themselves only hold physical frame numbers.
+#define MM_ENTRY_TABLE(ppn) MmPhysToVirt((uint64_t) (ppn) << 12)
+
 PageDirectory *kPML4;
+static uint8_t kHugePagesSupported = 0;
+static uint8_t kGlobalPagesEnabled = 0;
+static uint8_t kPcidEnabled = 0;
+
+static MmAddressSpace kKernelSpace;
+static MmPcidState kPcidStates[CPU_MAX];
+
+// Serializes every change to the kernel page tables, including the ones the fault handler makes, as well as the lazy
+// region list. Taken with interrupts off, a lazy fault may hit any code that touches the heap.
+static Spinlock kPagingLock = SPINLOCK_INIT;
 
+// CPUs that may hold translations of the kernel page tables. Other cores are started with interrupts off and no
+// IDT, so there is no TLB shootdown: frames and tables only go back to the PMM while the boot core is alone.
+static uint32_t kPagingCpus = 1;
+static MmLazyRegion kLazyRegions[MM_LAZY_REGIONS_MAX];
+static uint64_t kLazyRegionCount = 0;
+static MmFaultStatistics kFaultStatistics;
+
+
+static uint64_t MmAcquirePagingLock(void) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kPagingLock);
+    return flags;
+}
+
+static void MmReleasePagingLock(uint64_t flags) {
+    RtReleaseSpinlock(&kPagingLock);
+    IntelRestoreInterrupts(flags);
+}
 
 static void print_pde(PageDirectoryEntry *pde) {
-    ComPrint("[MM] p: %d w: %d u: %d wt: %d c: %d a: %d i3: %d s: %d i2: %d [pp: 0x%x] r: %d i1: %d n: %d\n",
+    ComPrint("[MM] p: %d w: %d u: %d wt: %d c: %d a: %d cn: %d s: %d g: %d [pp: 0x%x] r: %d l: %d n: %d\n",
              pde->present, pde->writeable, pde->user_access, pde->write_through, pde->cache_disabled,
-             pde->accessed, pde->ignored_3, pde->is_mapped, pde->ignored_2, pde->page_ppn, pde->reserved_1,
-             pde->ignored_1, pde->execution_disabled);
+             pde->accessed, pde->counted, pde->page_size, pde->global, pde->page_ppn, pde->reserved_1,
+             pde->live_entries, pde->execution_disabled);
 }
 
 static void print_pte(PageTableEntry *pte) {
     ComPrint("[MM] p: %d w: %d u: %d wt: %d c: %d a: %d d: %d s: %d g: %d i2: %d [pp: 0x%x] r: %d i1: %d n: %d\n",
              pte->present, pte->writeable, pte->user_access, pte->write_through, pte->cache_disabled,
-             pte->accessed, pte->dirty, pte->is_mapped, pte->global, pte->ignored_2, pte->page_ppn, pte->reserved_1,
+             pte->accessed, pte->dirty, pte->pat, pte->global, pte->ignored_2, pte->page_ppn, pte->reserved_1,
              pte->ignored_1, pte->execution_disabled);
 }
 
+static void MmFlushTlb() {
+    // Global entries survive a CR3 load, toggling CR4.PGE drops everything for every PCID.
+    if (kGlobalPagesEnabled) {
+        uint64_t cr4 = IntelGetCR4();
+        IntelSetCR4(cr4 & ~CR4_PGE);
+        IntelSetCR4(cr4);
+        return;
+    }
+
+    IntelSetCR3(IntelGetCR3());
+}
+
+// Marks every leaf entry below `table` as global. Levels count down from 4 (the PML4) to 1 (a page table).
+static void MmMarkGlobal(PageDirectory *table, uint64_t first, int level) {
+    for (uint64_t i = first; i < 512; i++) {
+        if (level == 1) {
+            PageTableEntry *pte = &((PageTable *) table)->entries[i];
+            if (pte->present)
+                pte->global = 1;
+            continue;
+        }
+
+        PageDirectoryEntry *pde = &table->entries[i];
+        if (!pde->present)
+            continue;
+
+        if (level < 4 && pde->page_size)
+            pde->global = 1;
+        else
+            MmMarkGlobal((PageDirectory *) MM_ENTRY_TABLE(pde->page_ppn), 0, level - 1);
+    }
+}
+
+// Has to run on every CPU before it uses a mapping that is not write-back, each one has its own PAT.
+void MmInitializePat() {
+    uint32_t eax, ebx, ecx, edx;
+    IntelCpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!((edx >> 16) & 1)) {
+        ComPrint("[MM] PAT is not supported, write-combining falls back to write-through\n");
+        return;
+    }
+
+    IntelWriteMsr(IA32_PAT, MM_PAT_LAYOUT);
+    IntelWriteBackInvalidate();
+    MmFlushTlb();
+}
+
 void MmInitializePaging() {
     ComPrint("[MM] Initializing paging\n");
 
-    kPML4 = (PageDirectory *) IntelGetCR3();
-    IntelSetCR3(kPML4);
+    uint64_t cr3 = (uint64_t) IntelGetCR3() & 0xfffffffffffff000;
+    kPML4 = (PageDirectory *) MmPhysToVirt(cr3);
+    IntelSetCR3((void *) cr3);
+
+    kKernelSpace.pml4 = cr3;
+    for (uint64_t cpu = 0; cpu < CPU_MAX; cpu++) {
+        kPcidStates[cpu].generation = 1;
+        kPcidStates[cpu].next = 1;
+        kPcidStates[cpu].current = &kKernelSpace;
+    }
+
+    uint32_t eax, ebx, ecx, edx;
+    IntelCpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+    kHugePagesSupported = (edx >> 26) & 1;
+    if (kHugePagesSupported)
+        ComPrint("[MM] 1 GiB pages are supported\n");
+
+    IntelCpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    uint8_t pge_supported = (edx >> 13) & 1;
+    uint8_t pcid_supported = (ecx >> 17) & 1;
+
+    MmInitializePat();
+
+    // Make sure every RAM-like region is in the direct map, and that it is covered with the largest pages possible.
+    // The framebuffer is written in bulk and never read back, so its stores are combined.
+    struct limine_memmap_response *memmap = MmGetMemoryMap();
+    for (uint64_t entry_index = 0; entry_index < memmap->entry_count; entry_index++) {
+        struct limine_memmap_entry *entry = memmap->entries[entry_index];
+        if (entry->type == LIMINE_MEMMAP_RESERVED || entry->type == LIMINE_MEMMAP_BAD_MEMORY)
+            continue;
+
+        uint8_t type = entry->type == LIMINE_MEMMAP_FRAMEBUFFER ? MM_MEMORY_WC : MM_MEMORY_WB;
+        MmMapRange(MmPhysToVirt(entry->base), (void *) entry->base, entry->length, type);
+    }
+
+    ComPrint("[MM] Direct map at 0x%X\n", kHhdmOffset);
+
+    // The higher half is shared by every address space, so its translations can survive CR3 loads.
+    if (pge_supported) {
+        MmMarkGlobal(kPML4, 256, 4);
+        IntelSetCR4(IntelGetCR4() | CR4_PGE);
+        kGlobalPagesEnabled = 1;
+        ComPrint("[MM] Global kernel pages enabled\n");
+    }
+
+    // CR3 currently uses PCID 0, which is the only state PCIDE may be turned on in. Recycling tags relies on the
+    // CR4.PGE toggle to flush every PCID at once, so PCIDs are only used together with global pages.
+    if (pcid_supported && kGlobalPagesEnabled) {
+        IntelSetCR4(IntelGetCR4() | CR4_PCIDE);
+        kPcidEnabled = 1;
+        ComPrint("[MM] PCIDs enabled\n");
+    }
+}
+
+MmAddressSpace *MmGetKernelSpace() {
+    return &kKernelSpace;
+}
+
+void MmSwitchAddressSpace(MmAddressSpace *space) {
+    uint64_t flags = IntelDisableInterrupts();
+    uint32_t cpu = CpuGetId();
+    MmPcidState *state = &kPcidStates[cpu];
+
+    if (state->current == space) {
+        IntelRestoreInterrupts(flags);
+        return;
+    }
+
+    state->current = space;
+
+    if (!kPcidEnabled) {
+        IntelSetCR3((void *) space->pml4);
+        IntelRestoreInterrupts(flags);
+        return;
+    }
+
+    uint64_t cr3 = space->pml4;
+    if (space->generation[cpu] == state->generation) {
+        // The tag is still live, keep whatever the TLB holds for it.
+        cr3 |= space->pcid[cpu] | CR3_NO_FLUSH;
+    } else {
+        if (state->next == MM_PCID_COUNT) {
+            // Out of tags: start a new generation and drop the TLB entries of every tag from the old one.
+            state->generation++;
+            state->next = 1;
+            MmFlushTlb();
+        }
+
+        // Loading without the no-flush bit clears anything a recycled tag might still have cached.
+        space->pcid[cpu] = state->next++;
+        space->generation[cpu] = state->generation;
+        cr3 |= space->pcid[cpu];
+    }
+
+    IntelSetCR3((void *) cr3);
+    IntelRestoreInterrupts(flags);
+}
+
+void MmAttachCpu(void) {
+    __atomic_add_fetch(&kPagingCpus, 1, __ATOMIC_ACQ_REL);
+}
+
+void MmDetachCpu(void) {
+    __atomic_sub_fetch(&kPagingCpus, 1, __ATOMIC_ACQ_REL);
+}
+
+void MmInvalidateAddressSpace(MmAddressSpace *space) {
+    // Forces a fresh, flushed tag the next time the space is loaded on any CPU.
+    for (uint64_t cpu = 0; cpu < CPU_MAX; cpu++)
+        space->generation[cpu] = 0;
 }
 
 void MmGetPageIndices(uint64_t address, PageMapIndex *map) {
@@ -39,142 +254,646 @@ void MmGetPageIndices(uint64_t address, PageMapIndex *map) {
     map->pdp = address & 0x1ff;
 }
 
-void MmMapMemory(void *virtual_memory, void *physical_memory) {
-    if ((uint64_t) virtual_memory & 0xfff)
-        ComPrint("[MM] Virtual memory address is not page aligned! (0x%X)\n", virtual_memory);
+// Small ranges are invalidated page by page, anything larger is cheaper to drop with a full flush through
+// MmFlushTlb, which toggles CR4.PGE once global pages are on since a CR3 load would keep the kernel's entries.
+static void MmFlushRange(uint64_t virtual_address, uint64_t size) {
+    if (size / PAGE_SIZE > MM_FLUSH_PAGE_LIMIT) {
+        MmFlushTlb();
+        return;
+    }
 
-    if ((uint64_t) physical_memory & 0xfff)
-        ComPrint("[MM] Physical memory address is not page aligned! (0x%X)\n", physical_memory);
+    for (uint64_t offset = 0; offset < size; offset += PAGE_SIZE)
+        IntelInvalidatePage((void *) (virtual_address + offset));
+}
 
-    // Page-align the addresses
-    virtual_memory = (void *) ((uint64_t) virtual_memory & 0xfffffffffffff000);
-    physical_memory = (void *) ((uint64_t) physical_memory & 0xfffffffffffff000);
+// Tables created by the VMM carry their live entry count in the entry that points at them. Tables inherited from
+// the bootloader are counted the first time they are touched.
+static uint64_t MmGetLiveEntries(PageDirectoryEntry *entry) {
+    if (!entry->counted) {
+        PageDirectory *table = (PageDirectory *) MM_ENTRY_TABLE(entry->page_ppn);
 
+        uint64_t live = 0;
+        for (uint64_t i = 0; i < 512; i++)
+            live += table->entries[i].present;
 
-    PageMapIndex map;
-    MmGetPageIndices((uint64_t) virtual_memory, &map);
+        entry->live_entries = live;
+        entry->counted = 1;
+    }
 
-    PageDirectoryEntry pde = kPML4->entries[map.pdp];
+    return entry->live_entries;
+}
 
-    PageDirectory *pdp;
-    if (!pde.present) {
-        pdp = (PageDirectory *) MmRequestPage();
-        RtZeroMemory(pdp, PAGE_SIZE);
+static void MmAddLiveEntries(PageDirectoryEntry *entry, uint64_t count) {
+    if (entry)
+        entry->live_entries = MmGetLiveEntries(entry) + count;
+}
 
-        pde.page_ppn = (uint64_t) pdp >> 12;
-        pde.present = 1;
-        pde.writeable = 1;
-        kPML4->entries[map.pdp] = pde;
-    } else {
-        pdp = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
+// Frames and tables taken out of the page tables by MmUnmapRange. The CPU may still reach them through its TLB or
+// paging-structure caches, so they only go back to the PMM once the range has been flushed. Only the local TLB is
+// flushed, which is why unmapping waits until the boot core is the only one attached.
+typedef struct MmUnmapBatch {
+    uint64_t start;
+    uint64_t end;
+    uint64_t count;
+    void *frames[MM_UNMAP_BATCH];
+    uint8_t orders[MM_UNMAP_BATCH];
+} MmUnmapBatch;
+
+static void MmReleaseBatch(MmUnmapBatch *batch) {
+    if (!batch->count)
+        return;
+
+    MmFlushRange(batch->start, batch->end - batch->start);
+
+    // Blocks above the largest buddy order, like a 1 GiB page, go straight back to the bitmap.
+    for (uint64_t i = 0; i < batch->count; i++) {
+        if (batch->orders[i] > MM_BUDDY_MAX_ORDER)
+            MmUnlockPages(batch->frames[i], 1ull << batch->orders[i]);
+        else if (batch->orders[i])
+            MmFreePages(batch->frames[i], batch->orders[i]);
+        else
+            MmFreePage(batch->frames[i]);
     }
 
-    pde = pdp->entries[map.pd];
-    PageDirectory *pd;
-    if (!pde.present) {
-        pd = (PageDirectory *) MmRequestPage();
-        RtZeroMemory(pd, PAGE_SIZE);
-        pde.page_ppn = (uint64_t) pd >> 12;
-        pde.present = 1;
-        pde.writeable = 1;
-        pdp->entries[map.pd] = pde;
+    batch->count = 0;
+}
+
+// A full batch is released early, which flushes the whole range once more at the end.
+static void MmDeferFree(MmUnmapBatch *batch, uint64_t frame, uint64_t order) {
+    if (batch->count == MM_UNMAP_BATCH)
+        MmReleaseBatch(batch);
+
+    batch->frames[batch->count] = (void *) frame;
+    batch->orders[batch->count] = order;
+    batch->count++;
+}
+
+// Drops `count` live entries from the table behind `entry` and queues the table for release once it is empty.
+// Returns whether `entry` was cleared, which in turn takes a live entry away from the table holding it.
+static uint8_t MmReleaseEntries(MmUnmapBatch *batch, PageDirectoryEntry *entry, uint64_t count) {
+    if (!entry || !count)
+        return 0;
+
+    uint64_t live = MmGetLiveEntries(entry);
+    if (live > count) {
+        entry->live_entries = live - count;
+        return 0;
+    }
+
+    uint64_t table = (uint64_t) entry->page_ppn << 12;
+    *entry = (PageDirectoryEntry) {0};
+    MmDeferFree(batch, table, 0);
+    return 1;
+}
+
+// Releases a table that is no longer referenced, `page_size` is the size of the pages its entries map.
+static void MmFreeTable(PageDirectory *table, uint64_t page_size) {
+    if (page_size == MM_LARGE_PAGE_SIZE) {
+        for (uint64_t i = 0; i < 512; i++) {
+            PageDirectoryEntry pde = table->entries[i];
+            if (pde.present && !pde.page_size)
+                MmFreePage((void *) ((uint64_t) pde.page_ppn << 12));
+        }
+    }
+
+    MmFreePage((void *) MmVirtToPhys(table));
+}
+
+// Replaces a large page with a table of the next smaller page size that maps the same memory.
+static void MmSplitLargeEntry(PageDirectoryEntry *entry, uint64_t page_size) {
+    PageDirectoryEntry large = *entry;
+    uint64_t base = ((uint64_t) large.page_ppn << 12) & ~(page_size - 1);
+    uint64_t table_address = (uint64_t) MmRequestZeroedPage();
+    void *table = MmPhysToVirt(table_address);
+
+    if (page_size == MM_HUGE_PAGE_SIZE) {
+        PageDirectory *pd = (PageDirectory *) table;
+        for (uint64_t i = 0; i < 512; i++) {
+            PageDirectoryEntry pde = large;
+            pde.page_ppn = (base + i * MM_LARGE_PAGE_SIZE) >> 12;
+            pd->entries[i] = pde;
+        }
     } else {
-        pd = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
+        PageTable *pt = (PageTable *) table;
+        for (uint64_t i = 0; i < 512; i++) {
+            PageTableEntry pte = pt->entries[i];
+            pte.present = 1;
+            pte.writeable = large.writeable;
+            pte.user_access = large.user_access;
+            pte.write_through = large.write_through;
+            pte.cache_disabled = large.cache_disabled;
+            pte.execution_disabled = large.execution_disabled;
+            pte.global = large.global;
+            pte.page_ppn = (base + i * PAGE_SIZE) >> 12;
+            pt->entries[i] = pte;
+        }
     }
 
-    pde = pd->entries[map.pt];
-    PageTable *pt;
-    if (!pde.present) {
-        pt = (PageTable *) MmRequestPage();
-        RtZeroMemory(pt, PAGE_SIZE);
-        pde.page_ppn = (uint64_t) pt >> 12;
+    PageDirectoryEntry pde = {0};
+    pde.page_ppn = table_address >> 12;
+    pde.present = 1;
+    pde.writeable = 1;
+    pde.user_access = large.user_access;
+    pde.counted = 1;
+    pde.live_entries = 512;
+    *entry = pde;
+}
+
+// Returns the table behind `entry`, creating it or splitting a large page of `page_size` that is in the way.
+// `owner` is the entry pointing at the table that holds `entry`, or 0 for the PML4.
+static PageDirectory *MmGetNextLevel(PageDirectoryEntry *owner, PageDirectoryEntry *entry, uint64_t page_size) {
+    if (!entry->present) {
+        MmAddLiveEntries(owner, 1);
+
+        PageDirectoryEntry pde = {0};
+        pde.page_ppn = (uint64_t) MmRequestZeroedPage() >> 12;
         pde.present = 1;
         pde.writeable = 1;
-        pd->entries[map.pt] = pde;
-    } else {
-        pt = (PageTable *) ((uint64_t) pde.page_ppn << 12);
+        pde.counted = 1;
+        *entry = pde;
+    } else if (entry->page_size) {
+        MmSplitLargeEntry(entry, page_size);
     }
 
+    return (PageDirectory *) MM_ENTRY_TABLE(entry->page_ppn);
+}
+
+// Returns whether a previous translation was replaced and has to be flushed.
+static uint8_t MmSetLargeEntry(PageDirectoryEntry *owner, PageDirectoryEntry *entry, uint64_t physical,
+                               uint64_t page_size, uint8_t type) {
+    PageDirectoryEntry pde = *entry;
+    uint8_t flush = pde.present;
+
+    if (!pde.present)
+        MmAddLiveEntries(owner, 1);
+
+    pde.page_ppn = physical >> 12;
+    pde.present = 1;
+    pde.writeable = 1;
+    pde.page_size = 1;
+    pde.global = 1;
+    pde.write_through = type & 1;
+    pde.cache_disabled = (type >> 1) & 1;
+
+    // A table that was here before is replaced wholesale, it can only be freed once nothing caches it anymore.
+    if (entry->present && !entry->page_size) {
+        PageDirectory *table = (PageDirectory *) MM_ENTRY_TABLE(entry->page_ppn);
+
+        pde.accessed = 0;
+        pde.counted = 0;
+        pde.live_entries = 0;
+        *entry = pde;
+
+        // Without a shootdown another core may still walk the old table, so it is left behind in that case.
+        MmFlushTlb();
+        if (__atomic_load_n(&kPagingCpus, __ATOMIC_ACQUIRE) == 1)
+            MmFreeTable(table, page_size / 512);
+        return 0;
+    }
+
+    *entry = pde;
+    return flush;
+}
+
+// Walks down to the page table covering `virtual_address`, creating missing levels and splitting large pages.
+// The entry pointing at the page table is returned through `owner`.
+static PageTable *MmWalkToTable(uint64_t virtual_address, PageDirectoryEntry **owner) {
+    PageMapIndex map;
+    MmGetPageIndices(virtual_address, &map);
+
+    PageDirectoryEntry *pml4e = &kPML4->entries[map.pdp];
+    PageDirectory *pdp = MmGetNextLevel(0, pml4e, 0);
+
+    PageDirectoryEntry *pdpe = &pdp->entries[map.pd];
+    PageDirectory *pd = MmGetNextLevel(pml4e, pdpe, MM_HUGE_PAGE_SIZE);
+
+    *owner = &pd->entries[map.pt];
+    PageTable *pt = (PageTable *) MmGetNextLevel(pdpe, *owner, MM_LARGE_PAGE_SIZE);
+
+    // Make sure a table inherited from the bootloader is counted before any of its entries change.
+    MmGetLiveEntries(*owner);
+    return pt;
+}
+
+// Returns whether a previous translation was replaced and has to be flushed.
+static uint8_t MmMapPage(uint64_t virtual_address, uint64_t physical_address, uint64_t page_size, uint8_t type) {
+    PageMapIndex map;
+    MmGetPageIndices(virtual_address, &map);
+
+    if (page_size != PAGE_SIZE) {
+        PageDirectoryEntry *pml4e = &kPML4->entries[map.pdp];
+        PageDirectory *pdp = MmGetNextLevel(0, pml4e, 0);
+        if (page_size == MM_HUGE_PAGE_SIZE)
+            return MmSetLargeEntry(pml4e, &pdp->entries[map.pd], physical_address, page_size, type);
+
+        PageDirectory *pd = MmGetNextLevel(pml4e, &pdp->entries[map.pd], MM_HUGE_PAGE_SIZE);
+        return MmSetLargeEntry(&pdp->entries[map.pd], &pd->entries[map.pt], physical_address, page_size, type);
+    }
+
+    PageDirectoryEntry *owner;
+    PageTable *pt = MmWalkToTable(virtual_address, &owner);
+
     PageTableEntry pte = pt->entries[map.p];
-    pte.page_ppn = (uint64_t) physical_memory >> 12;
+    uint8_t flush = pte.present;
+    if (!pte.present)
+        MmAddLiveEntries(owner, 1);
+
+    pte.page_ppn = physical_address >> 12;
     pte.present = 1;
     pte.writeable = 1;
+    pte.global = 1;
+    pte.write_through = type & 1;
+    pte.cache_disabled = (type >> 1) & 1;
+    pte.pat = 0;
     pt->entries[map.p] = pte;
+
+    return flush;
 }
 
-uint64_t MmGetPhysicalAddress(void *virtual_memory) {
+// Finds the entry that translates `address`. Large pages come back through `large`, 4 KiB pages through the
+// return value, and `page_size` tells which one it was. Returns 0 and leaves `large` empty if nothing is mapped.
+static PageTableEntry *MmFindEntry(uint64_t address, PageDirectoryEntry **large, uint64_t *page_size) {
     PageMapIndex map;
-    MmGetPageIndices((uint64_t) virtual_memory, &map);
+    MmGetPageIndices(address, &map);
+    *large = 0;
 
-    PageDirectoryEntry pde = kPML4->entries[map.pdp];
-    PageDirectory *pd = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
-    pde = pd->entries[map.pd];
-    pd = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
-    pde = pd->entries[map.pt];
+    PageDirectoryEntry *pde = &kPML4->entries[map.pdp];
+    if (!pde->present)
+        return 0;
 
-    PageTable *pt = (PageTable *) ((uint64_t) pde.page_ppn << 12);
-    PageTableEntry pte = pt->entries[map.p];
+    PageDirectory *pd = (PageDirectory *) MM_ENTRY_TABLE(pde->page_ppn);
+    pde = &pd->entries[map.pd];
+    if (!pde->present)
+        return 0;
 
-    return ((uint64_t) pte.page_ppn << 12) | ((uint64_t) virtual_memory & 0xfff);
+    if (pde->page_size) {
+        *large = pde;
+        *page_size = MM_HUGE_PAGE_SIZE;
+        return 0;
+    }
+
+    pd = (PageDirectory *) MM_ENTRY_TABLE(pde->page_ppn);
+    pde = &pd->entries[map.pt];
+    if (!pde->present)
+        return 0;
+
+    if (pde->page_size) {
+        *large = pde;
+        *page_size = MM_LARGE_PAGE_SIZE;
+        return 0;
+    }
+
+    PageTable *pt = (PageTable *) MM_ENTRY_TABLE(pde->page_ppn);
+    *page_size = PAGE_SIZE;
+    return &pt->entries[map.p];
+}
+
+void MmMapMemory(void *virtual_memory, void *physical_memory) {
+    if ((uint64_t) virtual_memory & 0xfff)
+        ComPrint("[MM] Virtual memory address is not page aligned! (0x%X)\n", virtual_memory);
+
+    if ((uint64_t) physical_memory & 0xfff)
+        ComPrint("[MM] Physical memory address is not page aligned! (0x%X)\n", physical_memory);
+
+    // Page-align the addresses
+    virtual_memory = (void *) ((uint64_t) virtual_memory & 0xfffffffffffff000);
+    physical_memory = (void *) ((uint64_t) physical_memory & 0xfffffffffffff000);
+
+    uint64_t flags = MmAcquirePagingLock();
+    if (MmMapPage((uint64_t) virtual_memory, (uint64_t) physical_memory, PAGE_SIZE, MM_MEMORY_WB))
+        IntelInvalidatePage(virtual_memory);
+    MmReleasePagingLock(flags);
 }
 
-void *MmGetIdentityPage() {
-    void *result = MmRequestPage();
-    MmMapMemory(result, result);
+void MmMapLarge(void *virtual_memory, void *physical_memory, uint64_t page_size) {
+    if (page_size != MM_LARGE_PAGE_SIZE && page_size != MM_HUGE_PAGE_SIZE) {
+        ComPrint("[MM] Invalid large page size! (0x%X)\n", page_size);
+        return;
+    }
+
+    if (((uint64_t) virtual_memory | (uint64_t) physical_memory) & (page_size - 1)) {
+        ComPrint("[MM] Large page mapping is not aligned! (0x%X -> 0x%X)\n", virtual_memory, physical_memory);
+        return;
+    }
+
+    if (page_size == MM_HUGE_PAGE_SIZE && !kHugePagesSupported) {
+        MmMapRange(virtual_memory, physical_memory, page_size, MM_MEMORY_WB);
+        return;
+    }
+
+    uint64_t flags = MmAcquirePagingLock();
+    if (MmMapPage((uint64_t) virtual_memory, (uint64_t) physical_memory, page_size, MM_MEMORY_WB))
+        IntelInvalidatePage(virtual_memory);
+    MmReleasePagingLock(flags);
+}
+
+// Picks the largest page that both addresses are aligned to and that still fits in the remaining size.
+static uint64_t MmPickPageSize(uint64_t virtual_address, uint64_t physical_address, uint64_t size) {
+    uint64_t alignment = virtual_address | physical_address;
+
+    if (kHugePagesSupported && size >= MM_HUGE_PAGE_SIZE && !(alignment & (MM_HUGE_PAGE_SIZE - 1)))
+        return MM_HUGE_PAGE_SIZE;
+
+    if (size >= MM_LARGE_PAGE_SIZE && !(alignment & (MM_LARGE_PAGE_SIZE - 1)))
+        return MM_LARGE_PAGE_SIZE;
+
+    return PAGE_SIZE;
+}
+
+// The range functions come in two layers, the public ones take kPagingLock and the *Locked ones expect it held.
+static void MmMapRangeLocked(void *virtual_memory, void *physical_memory, uint64_t size, uint8_t type) {
+    uint64_t offset = (uint64_t) virtual_memory & 0xfff;
+    uint64_t virtual_address = (uint64_t) virtual_memory - offset;
+    uint64_t physical_address = ((uint64_t) physical_memory - offset) & 0xfffffffffffff000;
+
+    uint64_t start = virtual_address;
+    uint64_t end = virtual_address + ((size + offset + PAGE_SIZE - 1) & 0xfffffffffffff000);
+    uint8_t flush = 0;
+
+    while (virtual_address < end) {
+        uint64_t page_size = MmPickPageSize(virtual_address, physical_address, end - virtual_address);
+        if (page_size != PAGE_SIZE) {
+            flush |= MmMapPage(virtual_address, physical_address, page_size, type);
+            virtual_address += page_size;
+            physical_address += page_size;
+            continue;
+        }
+
+        // Walk once per page table and fill entries up to its end, a large page can only start there anyway.
+        PageDirectoryEntry *owner;
+        PageTable *pt = MmWalkToTable(virtual_address, &owner);
+        uint64_t stop = MM_ALIGN_NEXT(virtual_address, MM_LARGE_PAGE_SIZE);
+        if (stop > end)
+            stop = end;
+
+        uint64_t added = 0;
+        for (uint64_t index = (virtual_address >> 12) & 0x1ff; virtual_address < stop; index++) {
+            PageTableEntry pte = pt->entries[index];
+            flush |= pte.present;
+            added += !pte.present;
+            pte.page_ppn = physical_address >> 12;
+            pte.present = 1;
+            pte.writeable = 1;
+            pte.global = 1;
+            pte.write_through = type & 1;
+            pte.cache_disabled = (type >> 1) & 1;
+            pte.pat = 0;
+            pt->entries[index] = pte;
+
+            virtual_address += PAGE_SIZE;
+            physical_address += PAGE_SIZE;
+        }
+
+        MmAddLiveEntries(owner, added);
+    }
+
+    if (flush)
+        MmFlushRange(start, end - start);
+}
+
+void MmMapRange(void *virtual_memory, void *physical_memory, uint64_t size, uint8_t type) {
+    uint64_t flags = MmAcquirePagingLock();
+    MmMapRangeLocked(virtual_memory, physical_memory, size, type);
+    MmReleasePagingLock(flags);
+}
+
+static int MmUnmapRangeLocked(void *virtual_memory, uint64_t size, uint8_t free_frames) {
+    if (__atomic_load_n(&kPagingCpus, __ATOMIC_ACQUIRE) != 1)
+        return -1;
+
+    uint64_t offset = (uint64_t) virtual_memory & 0xfff;
+    uint64_t virtual_address = (uint64_t) virtual_memory - offset;
+    uint64_t start = virtual_address;
+    uint64_t end = virtual_address + ((size + offset + PAGE_SIZE - 1) & 0xfffffffffffff000);
+    uint8_t flush = 0;
+
+    MmUnmapBatch batch;
+    batch.start = start;
+    batch.end = end;
+    batch.count = 0;
+
+    while (virtual_address < end) {
+        PageMapIndex map;
+        MmGetPageIndices(virtual_address, &map);
+
+        // Holes at any level are skipped as a whole instead of page by page.
+        PageDirectoryEntry *pml4e = &kPML4->entries[map.pdp];
+        if (!pml4e->present) {
+            virtual_address = MM_ALIGN_NEXT(virtual_address, MM_HUGE_PAGE_SIZE * 512ull);
+            continue;
+        }
+
+        PageDirectory *pdp = (PageDirectory *) MM_ENTRY_TABLE(pml4e->page_ppn);
+        PageDirectoryEntry *pdpe = &pdp->entries[map.pd];
+        if (!pdpe->present) {
+            virtual_address = MM_ALIGN_NEXT(virtual_address, MM_HUGE_PAGE_SIZE);
+            continue;
+        }
+
+        if (pdpe->page_size) {
+            if (!(virtual_address & (MM_HUGE_PAGE_SIZE - 1)) && end - virtual_address >= MM_HUGE_PAGE_SIZE) {
+                if (free_frames)
+                    MmDeferFree(&batch, (uint64_t) pdpe->page_ppn << 12, MmGetPageOrder(MM_HUGE_PAGE_SIZE / PAGE_SIZE));
+
+                *pdpe = (PageDirectoryEntry) {0};
+                MmReleaseEntries(&batch, pml4e, 1);
+                virtual_address += MM_HUGE_PAGE_SIZE;
+                flush = 1;
+                continue;
+            }
+
+            MmSplitLargeEntry(pdpe, MM_HUGE_PAGE_SIZE);
+        }
+
+        PageDirectory *pd = (PageDirectory *) MM_ENTRY_TABLE(pdpe->page_ppn);
+        PageDirectoryEntry *pde = &pd->entries[map.pt];
+        if (!pde->present) {
+            virtual_address = MM_ALIGN_NEXT(virtual_address, MM_LARGE_PAGE_SIZE);
+            continue;
+        }
+
+        if (pde->page_size) {
+            if (!(virtual_address & (MM_LARGE_PAGE_SIZE - 1)) && end - virtual_address >= MM_LARGE_PAGE_SIZE) {
+                if (free_frames)
+                    MmDeferFree(&batch, (uint64_t) pde->page_ppn << 12, MmGetPageOrder(MM_LARGE_PAGE_SIZE / PAGE_SIZE));
+
+                *pde = (PageDirectoryEntry) {0};
+                if (MmReleaseEntries(&batch, pdpe, 1))
+                    MmReleaseEntries(&batch, pml4e, 1);
+                virtual_address += MM_LARGE_PAGE_SIZE;
+                flush = 1;
+                continue;
+            }
+
+            MmSplitLargeEntry(pde, MM_LARGE_PAGE_SIZE);
+        }
+
+        PageTable *pt = (PageTable *) MM_ENTRY_TABLE(pde->page_ppn);
+        uint64_t stop = MM_ALIGN_NEXT(virtual_address, MM_LARGE_PAGE_SIZE);
+        if (stop > end)
+            stop = end;
+
+        MmGetLiveEntries(pde);
+
+        uint64_t released = 0;
+        for (uint64_t index = (virtual_address >> 12) & 0x1ff; virtual_address < stop; index++) {
+            PageTableEntry pte = pt->entries[index];
+            if (pte.present) {
+                if (free_frames)
+                    MmDeferFree(&batch, (uint64_t) pte.page_ppn << 12, 0);
+
+                pt->entries[index] = (PageTableEntry) {0};
+                released++;
+            }
+
+            virtual_address += PAGE_SIZE;
+        }
+
+        // Empty tables go back to the PMM, which may in turn empty the tables above them.
+        flush |= released != 0;
+        if (MmReleaseEntries(&batch, pde, released) && MmReleaseEntries(&batch, pdpe, 1))
+            MmReleaseEntries(&batch, pml4e, 1);
+    }
+
+    // Releasing the batch flushes the range before anything goes back to the PMM.
+    if (batch.count)
+        MmReleaseBatch(&batch);
+    else if (flush)
+        MmFlushRange(start, end - start);
+
+    return 0;
+}
+
+int MmUnmapRange(void *virtual_memory, uint64_t size, uint8_t free_frames) {
+    uint64_t flags = MmAcquirePagingLock();
+    int result = MmUnmapRangeLocked(virtual_memory, size, free_frames);
+    MmReleasePagingLock(flags);
     return result;
 }
 
-void MmSetPagePermissions(void *address, uint8_t permissions) {
-    PageMapIndex map;
-    MmGetPageIndices((uint64_t) address, &map);
+void MmUnmapMemory(void *virtual_memory, uint8_t free_frame) {
+    MmUnmapRange(virtual_memory, PAGE_SIZE, free_frame);
+}
 
-    PageDirectoryEntry pde;
-    PageDirectory *pd;
+void MmUnmapPhysical(void *virtual_memory, uint64_t size) {
+    uint64_t physical_address = MmVirtToPhys(virtual_memory) & 0xfffffffffffff000;
+    uint64_t end = (MmVirtToPhys(virtual_memory) + size + PAGE_SIZE - 1) & 0xfffffffffffff000;
 
-    pde = kPML4->entries[map.pdp];
-    pd = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
-    pde = pd->entries[map.pd];
-    pd = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
-    pde = pd->entries[map.pt];
+    // Memory map regions stay in the direct map for good, only the holes MmMapPhysical filled in are removed.
+    struct limine_memmap_response *memmap = MmGetMemoryMap();
+    uint64_t flags = MmAcquirePagingLock();
+    while (physical_address < end) {
+        uint64_t next = end;
+        uint8_t direct = 0;
 
-    PageTable *pt = (PageTable *) ((uint64_t) pde.page_ppn << 12);
-    PageTableEntry *pte = &pt->entries[map.p];
+        for (uint64_t entry_index = 0; entry_index < memmap->entry_count; entry_index++) {
+            struct limine_memmap_entry *entry = memmap->entries[entry_index];
+            if (entry->type == LIMINE_MEMMAP_RESERVED || entry->type == LIMINE_MEMMAP_BAD_MEMORY)
+                continue;
 
-    pte->writeable = (permissions & 1);
-    pte->user_access = ((permissions & 2) >> 1);
-    pte->execution_disabled = ((permissions & 4) >> 2);
-    pte->cache_disabled = ((permissions & 8) >> 3);
+            uint64_t base = entry->base & 0xfffffffffffff000;
+            uint64_t limit = (entry->base + entry->length + PAGE_SIZE - 1) & 0xfffffffffffff000;
+            if (physical_address >= base && physical_address < limit) {
+                direct = 1;
+                next = limit < end ? limit : end;
+                break;
+            }
+
+            if (base > physical_address && base < next)
+                next = base;
+        }
+
+        if (!direct)
+            MmUnmapRangeLocked(MmPhysToVirt(physical_address), next - physical_address, 0);
+
+        physical_address = next;
+    }
+    MmReleasePagingLock(flags);
 }
 
-uint8_t MmGetPagePermissions(void *address) {
-    PageMapIndex map;
-    MmGetPageIndices((uint64_t) address, &map);
+uint64_t MmGetPhysicalAddress(void *virtual_memory) {
+    uint64_t flags = MmAcquirePagingLock();
 
-    PageDirectoryEntry pde = kPML4->entries[map.pdp];
-    PageDirectory *pd = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
-    pde = pd->entries[map.pd];
-    pd = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
-    pde = pd->entries[map.pt];
+    PageDirectoryEntry *large;
+    uint64_t page_size;
+    PageTableEntry *pte = MmFindEntry((uint64_t) virtual_memory, &large, &page_size);
 
-    PageTable *pt = (PageTable *) ((uint64_t) pde.page_ppn << 12);
-    PageTableEntry pte = pt->entries[map.p];
+    uint64_t physical = 0;
+    if (large) {
+        uint64_t base = ((uint64_t) large->page_ppn << 12) & ~(page_size - 1);
+        physical = base | ((uint64_t) virtual_memory & (page_size - 1));
+    } else if (pte) {
+        physical = ((uint64_t) pte->page_ppn << 12) | ((uint64_t) virtual_memory & 0xfff);
+    }
+
+    MmReleasePagingLock(flags);
+    return physical;
+}
 
-    uint8_t result = pte.writeable;
-    result |= (pte.user_access << 1);
-    result |= (pte.execution_disabled << 2);
-    result |= (pte.cache_disabled << 3);
+static void MmWritePagePermissions(void *address, uint8_t permissions) {
+    PageDirectoryEntry *large;
+    uint64_t page_size;
+    PageTableEntry *pte = MmFindEntry((uint64_t) address, &large, &page_size);
+
+    if (large) {
+        large->writeable = (permissions & 1);
+        large->user_access = ((permissions & 2) >> 1);
+        large->execution_disabled = ((permissions & 4) >> 2);
+        large->cache_disabled = ((permissions & 8) >> 3);
+    } else if (pte) {
+        pte->writeable = (permissions & 1);
+        pte->user_access = ((permissions & 2) >> 1);
+        pte->execution_disabled = ((permissions & 4) >> 2);
+        pte->cache_disabled = ((permissions & 8) >> 3);
+    }
+}
+
+static uint8_t MmReadPagePermissions(void *address) {
+    PageDirectoryEntry *large;
+    uint64_t page_size;
+    PageTableEntry *pte = MmFindEntry((uint64_t) address, &large, &page_size);
+
+    uint8_t result = 0;
+    if (large) {
+        result = large->writeable;
+        result |= (large->user_access << 1);
+        result |= (large->execution_disabled << 2);
+        result |= (large->cache_disabled << 3);
+    } else if (pte) {
+        result = pte->writeable;
+        result |= (pte->user_access << 1);
+        result |= (pte->execution_disabled << 2);
+        result |= (pte->cache_disabled << 3);
+    }
 
     return result;
 }
 
+void MmSetPagePermissions(void *address, uint8_t permissions) {
+    uint64_t flags = MmAcquirePagingLock();
+    MmWritePagePermissions(address, permissions);
+    MmReleasePagingLock(flags);
+}
+
+uint8_t MmGetPagePermissions(void *address) {
+    uint64_t flags = MmAcquirePagingLock();
+    uint8_t permissions = MmReadPagePermissions(address);
+    MmReleasePagingLock(flags);
+    return permissions;
+}
+
 void MmPageSet(void *address, uint8_t field) {
-    uint8_t new_permissions = MmGetPagePermissions(address) | field;
-    MmSetPagePermissions(address, new_permissions);
+    uint64_t flags = MmAcquirePagingLock();
+    uint8_t new_permissions = MmReadPagePermissions(address) | field;
+    MmWritePagePermissions(address, new_permissions);
+    MmReleasePagingLock(flags);
 }
 
 void MmPageClear(void *address, uint8_t field) {
-    uint8_t new_permissions = MmGetPagePermissions(address) & ~field;
-    MmSetPagePermissions(address, new_permissions);
+    uint64_t flags = MmAcquirePagingLock();
+    uint8_t new_permissions = MmReadPagePermissions(address) & ~field;
+    MmWritePagePermissions(address, new_permissions);
+    MmReleasePagingLock(flags);
 }
 
 void MmDebugPrint(void *virtual_memory, void *physical_memory) {
@@ -188,22 +907,130 @@ void MmDebugPrint(void *virtual_memory, void *physical_memory) {
     pde = kPML4->entries[map.pdp];
     ComPrint("PDP entry at: %p\n", &kPML4->entries[map.pdp]);
     print_pde(&pde);
-    pd = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
+    pd = (PageDirectory *) MM_ENTRY_TABLE(pde.page_ppn);
     pde = pd->entries[map.pd];
     ComPrint("PD entry at: %p\n", &pd->entries[map.pd]);
     print_pde(&pde);
-    pd = (PageDirectory *) ((uint64_t) pde.page_ppn << 12);
 
-    pde = pd->entries[map.pt];
-    ComPrint("PT entry at: %p\n", &pd->entries[map.pt]);
-    print_pde(&pde);
+    if (!pde.page_size) {
+        pd = (PageDirectory *) MM_ENTRY_TABLE(pde.page_ppn);
 
-    PageTable *pt = (PageTable *) ((uint64_t) pde.page_ppn << 12);
-    PageTableEntry pte = pt->entries[map.p];
-    ComPrint("P entry at: %p\n", &pt->entries[map.p]);
-    print_pte(&pte);
+        pde = pd->entries[map.pt];
+        ComPrint("PT entry at: %p\n", &pd->entries[map.pt]);
+        print_pde(&pde);
+
+        if (!pde.page_size) {
+            PageTable *pt = (PageTable *) MM_ENTRY_TABLE(pde.page_ppn);
+            PageTableEntry pte = pt->entries[map.p];
+            ComPrint("P entry at: %p\n", &pt->entries[map.p]);
+            print_pte(&pte);
+        }
+    }
 
-    uint64_t physical = ((uint64_t) pte.page_ppn << 12) | ((uint64_t) virtual_memory & 0xfff);
+    uint64_t physical = MmGetPhysicalAddress(virtual_memory);
     ComPrint("Points to physical: %llx\n", physical);
     ComPrint("I said it was:      %llx\n", physical_memory);
 }
+
+void *MmMapPhysical(uint64_t physical_address, uint64_t size) {
+    uint64_t address = physical_address & 0xfffffffffffff000;
+    uint64_t end = (physical_address + size + PAGE_SIZE - 1) & 0xfffffffffffff000;
+
+    // Most of physical memory is in the direct map already, only fill in what is missing (MMIO, firmware holes).
+    uint64_t flags = MmAcquirePagingLock();
+    while (address < end) {
+        PageDirectoryEntry *large;
+        uint64_t page_size;
+        PageTableEntry *pte = MmFindEntry((uint64_t) MmPhysToVirt(address), &large, &page_size);
+        if (!large && !(pte && pte->present))
+            break;
+
+        address = (address & ~(page_size - 1)) + page_size;
+    }
+
+    if (address < end)
+        MmMapRangeLocked(MmPhysToVirt(address), (void *) address, end - address, MM_MEMORY_WB);
+    MmReleasePagingLock(flags);
+
+    return MmPhysToVirt(physical_address);
+}
+
+int MmRegisterLazyRegion(void *virtual_address, uint64_t size) {
+    uint64_t start = (uint64_t) virtual_address & 0xfffffffffffff000;
+    uint64_t end = ((uint64_t) virtual_address + size + PAGE_SIZE - 1) & 0xfffffffffffff000;
+
+    uint64_t flags = MmAcquirePagingLock();
+
+    int result = -1;
+    if (kLazyRegionCount < MM_LAZY_REGIONS_MAX) {
+        kLazyRegions[kLazyRegionCount].start = start;
+        kLazyRegions[kLazyRegionCount].end = end;
+        kLazyRegionCount++;
+        result = 0;
+    }
+
+    MmReleasePagingLock(flags);
+
+    if (result)
+        ComPrint("[MM] Too many lazy regions, 0x%X is not registered\n", start);
+
+    return result;
+}
+
+uint8_t MmHandlePageFault(uint64_t address, uint32_t error) {
+    // Only faults on pages that are not present can be satisfied by committing memory.
+    if (error & 1)
+        return 0;
+
+    uint64_t begin = IntelReadTsc();
+    uint64_t page = address & 0xfffffffffffff000;
+
+    // The same lock as every other page table change, so a heap shrinking on another CPU can't free the table this
+    // fault is filling in.
+    uint64_t flags = MmAcquirePagingLock();
+
+    kFaultStatistics.faults++;
+
+    uint8_t lazy = 0;
+    for (uint64_t i = 0; i < kLazyRegionCount; i++) {
+        if (page >= kLazyRegions[i].start && page < kLazyRegions[i].end) {
+            lazy = 1;
+            break;
+        }
+    }
+
+    uint8_t resolved = 0;
+    if (lazy) {
+        // Another CPU may have committed the page while this one was waiting for the lock.
+        PageDirectoryEntry *large;
+        uint64_t page_size;
+        PageTableEntry *pte = MmFindEntry(page, &large, &page_size);
+
+        if (large || (pte && pte->present)) {
+            resolved = 1;
+        } else {
+            void *frame = MmRequestZeroedPage();
+            if (frame) {
+                MmMapPage(page, (uint64_t) frame, PAGE_SIZE, MM_MEMORY_WB);
+                resolved = 1;
+            }
+        }
+    }
+
+    if (resolved) {
+        uint64_t cycles = IntelReadTsc() - begin;
+
+        kFaultStatistics.resolved++;
+        kFaultStatistics.cycles += cycles;
+        if (cycles > kFaultStatistics.max_cycles)
+            kFaultStatistics.max_cycles = cycles;
+    }
+
+    MmReleasePagingLock(flags);
+
+    return resolved;
+}
+
+void MmGetFaultStatistics(MmFaultStatistics *statistics) {
+    *statistics = kFaultStatistics;
+}
@@ -1,8 +1,35 @@
 #pragma once
 
 #include "pmm.h"
+#include <cpu/percpu.h>
 #include <stdint.h>
 
+// Large pages are mapped directly by a page directory entry (2 MiB) or a page directory pointer entry (1 GiB).
+#define MM_LARGE_PAGE_SIZE 0x200000
+#define MM_HUGE_PAGE_SIZE 0x40000000
+
+// Virtual ranges that are only backed by physical memory once they are touched.
+#define MM_LAZY_REGIONS_MAX 16
+
+typedef struct MmLazyRegion {
+    uint64_t start;
+    uint64_t end;
+} MmLazyRegion;
+
+typedef struct MmFaultStatistics {
+    uint64_t faults;
+    uint64_t resolved;
+    uint64_t cycles;
+    uint64_t max_cycles;
+} MmFaultStatistics;
+
+// Memory types pick one of the first four IA32_PAT entries through the PWT and PCD bits, the PAT bit stays clear.
+// Entries 0, 2 and 3 match the power-on defaults, entry 1 is write-combining instead of write-through.
+#define MM_MEMORY_WB 0
+#define MM_MEMORY_WC 1
+#define MM_MEMORY_UC_MINUS 2
+#define MM_MEMORY_UC 3
+
 #define PAGE_WRITE_BIT 0x1
 #define PAGE_USER_BIT 0x2
 #define PAGE_NX_BIT 0x4
@@ -17,6 +44,8 @@
 #define PAGE_DISABLE_CACHE(x) ((page_set((x), PAGE_CACHE_DISABLE)))
 #define PAGE_ENABLE_CACHE(x) ((page_clear((x), PAGE_CACHE_DISABLE)))
 
+// Bits 6 and 52-62 are ignored by the CPU in entries that point at a table, the VMM keeps the number of present
+// entries in that table there. For large pages bit 6 is the dirty bit instead.
 typedef struct __attribute__((packed)) {
     uint64_t present : 1;
     uint64_t writeable : 1;
@@ -24,12 +53,13 @@ typedef struct __attribute__((packed)) {
     uint64_t write_through : 1;
     uint64_t cache_disabled : 1;
     uint64_t accessed : 1;
-    uint64_t ignored_3 : 1;
-    uint64_t is_mapped : 1;
-    uint64_t ignored_2 : 4;
+    uint64_t counted : 1;
+    uint64_t page_size : 1;
+    uint64_t global : 1;
+    uint64_t ignored_2 : 3;
     uint64_t page_ppn : 28;
     uint64_t reserved_1 : 12;
-    uint64_t ignored_1 : 11;
+    uint64_t live_entries : 11;
     uint64_t execution_disabled : 1;
 } PageDirectoryEntry;
 
@@ -41,7 +71,7 @@ typedef struct __attribute__((__packed__)) {
     uint64_t cache_disabled : 1;
     uint64_t accessed : 1;
     uint64_t dirty : 1;
-    uint64_t is_mapped : 1;
+    uint64_t pat : 1;
     uint64_t global : 1;
     uint64_t ignored_2 : 3;
     uint64_t page_ppn : 28;
@@ -58,6 +88,14 @@ typedef struct __attribute__((aligned(PAGE_SIZE))) {
     PageTableEntry entries[512];
 } PageTable;
 
+// A set of page tables plus the PCID it is tagged with on every CPU. A tag is only valid while its generation
+// matches the CPU's current one, recycling PCIDs bumps the generation and thereby retires every older tag.
+typedef struct MmAddressSpace {
+    uint64_t pml4;
+    uint16_t pcid[CPU_MAX];
+    uint64_t generation[CPU_MAX];
+} MmAddressSpace;
+
 typedef struct {
     uint64_t pdp;
     uint64_t pd;
@@ -66,11 +104,31 @@ typedef struct {
 } PageMapIndex;
 
 void MmInitializePaging();
+void MmInitializePat();
+
+MmAddressSpace *MmGetKernelSpace();
+void MmSwitchAddressSpace(MmAddressSpace *space);
+void MmInvalidateAddressSpace(MmAddressSpace *space);
+
+// A core is attached before it first runs kernel code and detaches once it is parked for good, it never uses a
+// kernel address again after that. Unmapping is refused while more than one core is attached, there is no TLB
+// shootdown yet.
+void MmAttachCpu(void);
+void MmDetachCpu(void);
 void MmGetPageIndices(uint64_t virtual_address, PageMapIndex *map);
 
 void MmMapMemory(void *virtual_address, void *physical_address);
+void MmMapLarge(void *virtual_address, void *physical_address, uint64_t page_size);
+void MmMapRange(void *virtual_address, void *physical_address, uint64_t size, uint8_t type);
+void MmUnmapMemory(void *virtual_address, uint8_t free_frame);
+int MmUnmapRange(void *virtual_address, uint64_t size, uint8_t free_frames);
+
+int MmRegisterLazyRegion(void *virtual_address, uint64_t size);
+uint8_t MmHandlePageFault(uint64_t address, uint32_t error);
+void MmGetFaultStatistics(MmFaultStatistics *statistics);
 uint64_t MmGetPhysicalAddress(void *virtual_address);
-void *MmGetIdentityPage();
+void *MmMapPhysical(uint64_t physical_address, uint64_t size);
+void MmUnmapPhysical(void *virtual_address, uint64_t size);
 
 void MmPageSet(void *address, uint8_t field);
 void MmPageClear(void *address, uint8_t field);
@@ -1,7 +1,8 @@
 #include "sched.h"
 
 #include <cpu/intel.h>
-#include <mem/heap.h>
+#include <mem/pmm.h>
+#include <mem/slab.h>
 #include <utl/serial.h>
 
 Task *kTasks = 0;
@@ -11,13 +12,33 @@ Task *kTask = 0;
 
 uint64_t kNextPid = 0;
 
+static KmCache *kTaskCache = 0;
+
+// The run queue is a plain list, lookups by pid go through this tree instead of walking it.
+static RbTree kTasksByPid = RB_TREE_INIT;
+
+static int TskComparePid(RbNode *a, RbNode *b) {
+    Task *left = RB_CONTAINER(a, Task, node);
+    Task *right = RB_CONTAINER(b, Task, node);
+    return left->pid < right->pid ? -1 : left->pid > right->pid;
+}
+
+static int TskComparePidKey(RbNode *node, void *key) {
+    uint64_t pid = RB_CONTAINER(node, Task, node)->pid;
+    return pid < (uint64_t) key ? -1 : pid > (uint64_t) key;
+}
+
 
 static void TskIdleTask() {
-    while (1)
-        __asm__ __volatile__("hlt");
+    while (1) {
+        // Use the idle time to top up the zeroed page pool, sleep once it is full.
+        if (!MmRefillZeroedPages(MM_ZERO_POOL_BATCH))
+            __asm__ __volatile__("hlt");
+    }
 }
 
 void TskInitialize(void) {
+    kTaskCache = KmCacheCreate("Task", sizeof(Task), KM_CACHE_LINE, 0);
     TskCreateKernelTask("Kernel Idle", TskIdleTask);
 }
 
@@ -32,7 +53,7 @@ void TskPrintTasks(void) {
 }
 
 Task *TskCreateTask(const char *name, TaskEntry entry) {
-    Task *task = (Task *) kmalloc(sizeof(Task));
+    Task *task = (Task *) KmCacheAlloc(kTaskCache);
     RtZeroMemory(task, sizeof(Task));
 
     if (!kTasks) {
@@ -47,12 +68,18 @@ Task *TskCreateTask(const char *name, TaskEntry entry) {
     task->name = name;
     task->entry = entry;
 
+    RB_INSERT(&kTasksByPid, task, TskComparePid, node);
+
     return task;
 }
 
+Task *TskGetTask(uint64_t pid) {
+    return RB_FIND(&kTasksByPid, (void *) pid, TskComparePidKey, Task, node);
+}
+
 Task *TskCreateKernelTask(const char *name, TaskEntry entry) {
     Task *task = TskCreateTask(name, entry);
-    task->memory = IntelGetCR3();
+    task->memory = MmGetKernelSpace();
     return task;
 }
 
@@ -66,9 +93,10 @@ void TskSchedule(void) {
     if (!next)
         next = kTasks;
 
+    // Tasks sharing an address space switch without touching CR3 at all.
+    Task *previous = kTask;
     kTask = next;
 
-    IntelSetCR3(kTask->memory);
-
-
+    if (kTask->memory != previous->memory)
+        MmSwitchAddressSpace(kTask->memory);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <lib/rbtree.h>
 #include <mem/vmm.h>
 
 typedef void (*TaskEntry)(void);
@@ -18,12 +19,15 @@ typedef struct Task {
 
     TaskEntry entry;
 
-    PageDirectory *memory;
+    MmAddressSpace *memory;
 
     uint64_t rip;
     uint64_t rsp, rbp;
 
     struct Task *next;
+
+    // Links the task into the pid index.
+    RbNode node;
 } Task;
 
 void TskInitialize(void);
@@ -34,4 +38,6 @@ Task *TskCreateTask(const char *name, TaskEntry entry);
 Task *TskCreateKernelTask(const char *name, TaskEntry entry);
 Task *TskCreateUserTask(const char *name, TaskEntry entry);
 
+Task *TskGetTask(uint64_t pid);
+
 void TskSchedule(void);
@@ -0,0 +1,338 @@
+#include "bench.h"
+
+#ifdef KERNEL_BENCHMARK
+
+#include <cpu/intel.h>
+#include <cpu/percpu.h>
+#include <limine.h>
+#include <mem/heap.h>
+#include <mem/pmm.h>
+#include <mem/vma.h>
+#include <mem/vmm.h>
+#include <utl/serial.h>
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CALIBRATION_HZ 100
+
+#define BENCH_LAZY_PAGES 4096
+#define BENCH_VMA_AREAS 1024
+#define BENCH_HEAP_SLOTS 1024
+#define BENCH_HEAP_OPERATIONS 200000
+#define BENCH_KMALLOC_PAIRS 100000
+#define BENCH_KMALLOC_EXCHANGE 256
+
+typedef struct BenchPage {
+    struct BenchPage *next;
+} BenchPage;
+
+static uint64_t kTscFrequency = 0;
+
+static uint64_t BenchCalibrateTsc(void) {
+    // Run PIT channel 2 as a one-shot for 10ms and count the TSC ticks in between.
+    uint16_t count = PIT_FREQUENCY / PIT_CALIBRATION_HZ;
+
+    IoOut8(0x61, (IoIn8(0x61) & ~0x02) | 0x01);
+    IoOut8(0x43, 0xB0);
+    IoOut8(0x42, count & 0xFF);
+    IoOut8(0x42, count >> 8);
+
+    uint8_t gate = IoIn8(0x61);
+    IoOut8(0x61, gate & ~0x01);
+    IoOut8(0x61, gate | 0x01);
+
+    uint64_t start = IntelReadTsc();
+    while (!(IoIn8(0x61) & 0x20))
+        ;
+
+    return (IntelReadTsc() - start) * PIT_CALIBRATION_HZ;
+}
+
+static uint64_t BenchPerSecond(uint64_t operations, uint64_t cycles) {
+    if (!cycles)
+        return 0;
+    return operations * kTscFrequency / cycles;
+}
+
+// The benchmark threads its page list through the frames themselves, reached via the direct map.
+static BenchPage *BenchRequestPage(void) {
+    void *address = MmRequestPage();
+    return address ? (BenchPage *) MmPhysToVirt((uint64_t) address) : 0;
+}
+
+static void BenchFreePage(BenchPage *page) {
+    MmFreePage((void *) MmVirtToPhys(page));
+}
+
+static void BenchPmmOccupancy(BenchPage **pages, uint64_t percent) {
+    uint64_t usable = kMemory->free_memory + kMemory->locked_memory + kMemory->reserved_memory;
+    uint64_t target_free = usable - usable * percent / 100;
+
+    while (kMemory->free_memory > target_free) {
+        BenchPage *page = BenchRequestPage();
+        if (!page)
+            break;
+        page->next = *pages;
+        *pages = page;
+    }
+
+    // Punch scattered holes into the filled memory so that every allocation has to search for one.
+    uint64_t holes = 0, index = 0;
+    for (BenchPage **link = pages; *link;) {
+        if ((index++ & 63) != 0) {
+            link = &(*link)->next;
+            continue;
+        }
+
+        BenchPage *page = *link;
+        *link = page->next;
+        BenchFreePage(page);
+        holes++;
+    }
+
+    // The holes may have been cached by another allocator layer, so the refill can come up short.
+    uint64_t refilled = 0;
+    uint64_t start = IntelReadTsc();
+    for (; refilled < holes; refilled++) {
+        BenchPage *page = BenchRequestPage();
+        if (!page)
+            break;
+        page->next = *pages;
+        *pages = page;
+    }
+    uint64_t cycles = IntelReadTsc() - start;
+
+    ComPrint("[BENCH] PMM at %D%% occupancy: %D allocations, %D cycles/op, %D allocations/sec\n",
+             percent, refilled, refilled ? cycles / refilled : 0, BenchPerSecond(refilled, cycles));
+}
+
+static void BenchRunPmm(void) {
+    BenchPage *pages = 0;
+
+    BenchPmmOccupancy(&pages, 10);
+    BenchPmmOccupancy(&pages, 50);
+    BenchPmmOccupancy(&pages, 95);
+
+    while (pages) {
+        BenchPage *next = pages->next;
+        BenchFreePage(pages);
+        pages = next;
+    }
+
+    MmPageCacheStatistics statistics;
+    MmGetPageCacheStatistics(CpuGetId(), &statistics);
+    ComPrint("[BENCH] PMM cache: %D allocations, %D frees, %D misses, %D refills, %D drains\n",
+             statistics.allocations, statistics.frees, statistics.misses, statistics.refills, statistics.drains);
+}
+
+static void BenchRunFaults(void) {
+    MmFaultStatistics before, after;
+    MmVma *area = MmAllocateVirtual(BENCH_LAZY_PAGES * PAGE_SIZE, PAGE_SIZE, MM_VMA_LAZY);
+    MmRegisterLazyRegion((void *) area->start, BENCH_LAZY_PAGES * PAGE_SIZE);
+    MmGetFaultStatistics(&before);
+
+    uint64_t start = IntelReadTsc();
+    for (uint64_t page = 0; page < BENCH_LAZY_PAGES; page++)
+        *(volatile uint8_t *) (area->start + page * PAGE_SIZE) = 1;
+    uint64_t cycles = IntelReadTsc() - start;
+
+    MmGetFaultStatistics(&after);
+    uint64_t resolved = after.resolved - before.resolved;
+    ComPrint("[BENCH] Demand paging: %D faults, %D cycles/fault in handler (max %D), %D touches/s\n",
+             resolved, resolved ? (after.cycles - before.cycles) / resolved : 0, after.max_cycles,
+             BenchPerSecond(BENCH_LAZY_PAGES, cycles));
+}
+
+static void BenchRunVma(void) {
+    static MmVma *areas[BENCH_VMA_AREAS];
+
+    // Leave one-page holes between the areas so that every bigger request has to skip all of them.
+    for (uint64_t i = 0; i < BENCH_VMA_AREAS; i++)
+        areas[i] = MmAllocateVirtual(PAGE_SIZE, PAGE_SIZE, 0);
+    for (uint64_t i = 0; i < BENCH_VMA_AREAS; i += 2)
+        MmFreeVirtual(areas[i]);
+
+    uint64_t start = IntelReadTsc();
+    for (uint64_t i = 0; i < BENCH_VMA_AREAS; i += 2)
+        areas[i] = MmAllocateVirtual(2 * PAGE_SIZE, PAGE_SIZE, 0);
+    uint64_t cycles = IntelReadTsc() - start;
+
+    MmVmaStatistics statistics;
+    MmGetVmaStatistics(&statistics);
+    ComPrint("[BENCH] VMA: %D areas, %D cycles/allocation past %D holes\n", statistics.areas,
+             cycles / (BENCH_VMA_AREAS / 2), BENCH_VMA_AREAS / 2);
+
+    for (uint64_t i = 0; i < BENCH_VMA_AREAS; i++)
+        MmFreeVirtual(areas[i]);
+}
+
+static uint64_t BenchRandom(uint64_t *state) {
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return *state >> 33;
+}
+
+// The trace goes to kHeap directly, through kmalloc most of it would be served by the per-CPU size classes. Every
+// call takes the heap lock the same way kmalloc does.
+static void *BenchHeapAllocate(uint64_t size) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kHeapLock);
+    void *address = HeapAllocate(kHeap, size, 0);
+    RtReleaseSpinlock(&kHeapLock);
+    IntelRestoreInterrupts(flags);
+    return address;
+}
+
+static void BenchHeapFree(void *address) {
+    uint64_t flags = IntelDisableInterrupts();
+    RtAcquireSpinlock(&kHeapLock);
+    HeapFree(kHeap, address);
+    RtReleaseSpinlock(&kHeapLock);
+    IntelRestoreInterrupts(flags);
+}
+
+// Replays a fixed mix of mostly small, some medium and a few large allocations with random lifetimes.
+static void BenchRunHeap(void) {
+    static void *slots[BENCH_HEAP_SLOTS];
+    uint64_t state = 0x5EED;
+    uint64_t allocations = 0, frees = 0;
+
+    uint64_t start = IntelReadTsc();
+    for (uint64_t operation = 0; operation < BENCH_HEAP_OPERATIONS; operation++) {
+        uint64_t slot = BenchRandom(&state) % BENCH_HEAP_SLOTS;
+        if (slots[slot]) {
+            BenchHeapFree(slots[slot]);
+            slots[slot] = 0;
+            frees++;
+            continue;
+        }
+
+        uint64_t kind = BenchRandom(&state) % 100;
+        uint64_t size;
+        if (kind < 70)
+            size = 16 + BenchRandom(&state) % 240;
+        else if (kind < 95)
+            size = 256 + BenchRandom(&state) % 3840;
+        else
+            size = 4096 + BenchRandom(&state) % 61440;
+
+        slots[slot] = BenchHeapAllocate(size);
+        *(volatile uint8_t *) slots[slot] = 0;
+        allocations++;
+    }
+    uint64_t cycles = IntelReadTsc() - start;
+
+    // Fragmentation is the share of free heap memory that is not part of the largest hole.
+    HeapStatistics statistics;
+    HeapGetStatistics(kHeap, &statistics);
+    uint64_t fragmentation = statistics.free ? 100 - statistics.largest_hole * 100 / statistics.free : 0;
+    ComPrint("[BENCH] Heap trace: %D allocations, %D frees, %D ops/s, %D cycles/op\n", allocations, frees,
+             BenchPerSecond(BENCH_HEAP_OPERATIONS, cycles), cycles / BENCH_HEAP_OPERATIONS);
+    ComPrint("[BENCH] Heap after trace: %D bytes used, %D free in %D holes, %D%% fragmented, span %D\n",
+             statistics.used, statistics.free, statistics.holes, fragmentation, statistics.span);
+
+    for (uint64_t slot = 0; slot < BENCH_HEAP_SLOTS; slot++) {
+        BenchHeapFree(slots[slot]);
+        slots[slot] = 0;
+    }
+}
+
+void BenchRunAll(void) {
+    kTscFrequency = BenchCalibrateTsc();
+    ComPrint("[BENCH] TSC frequency: %D Hz\n", kTscFrequency);
+
+    BenchRunPmm();
+    BenchRunFaults();
+    BenchRunVma();
+    BenchRunHeap();
+}
+
+static volatile uint32_t kBenchCores = 0;
+static volatile uint32_t kBenchArrived = 0;
+static uint64_t kBenchLocalCycles[CPU_MAX];
+static uint64_t kBenchRemoteCycles[CPU_MAX];
+static void *kBenchExchange[CPU_MAX][BENCH_KMALLOC_EXCHANGE];
+
+static void BenchBarrier(uint32_t phase) {
+    __atomic_fetch_add(&kBenchArrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&kBenchArrived, __ATOMIC_ACQUIRE) < phase * kBenchCores)
+        __asm__ volatile("pause");
+}
+
+// Every core first runs allocate/free pairs on its own, then frees a batch of objects another core allocated.
+static void BenchKmallocWorker(uint32_t core) {
+    BenchBarrier(1);
+
+    uint64_t start = IntelReadTsc();
+    for (uint64_t pair = 0; pair < BENCH_KMALLOC_PAIRS; pair++) {
+        void *object = kmalloc(16 + (pair & 7) * 16);
+        *(volatile uint8_t *) object = 0;
+        kfree(object);
+    }
+    kBenchLocalCycles[core] = IntelReadTsc() - start;
+
+    for (uint64_t i = 0; i < BENCH_KMALLOC_EXCHANGE; i++)
+        kBenchExchange[core][i] = kmalloc(64);
+
+    BenchBarrier(2);
+
+    uint32_t neighbour = (core + 1) % kBenchCores;
+    start = IntelReadTsc();
+    for (uint64_t i = 0; i < BENCH_KMALLOC_EXCHANGE; i++)
+        kfree(kBenchExchange[neighbour][i]);
+    kBenchRemoteCycles[core] = IntelReadTsc() - start;
+
+    BenchBarrier(3);
+}
+
+static void BenchSmpEntry(struct limine_smp_info *info) {
+    CpuInitializeLocal(info->extra_argument);
+    BenchKmallocWorker(info->extra_argument);
+
+    // The rest of the kernel doesn't run on secondary cores yet, park them for good.
+    MmDetachCpu();
+    while (1)
+        __asm__ volatile("cli; hlt");
+}
+
+void BenchRunSmp(struct limine_smp_response *smp) {
+    uint32_t cores = 1;
+    if (smp) {
+        // Cores past CPU_MAX get an id that fails the check below, so they are never started.
+        for (uint64_t i = 0; i < smp->cpu_count; i++) {
+            if (smp->cpus[i]->lapic_id != smp->bsp_lapic_id)
+                smp->cpus[i]->extra_argument = cores < CPU_MAX ? cores++ : CPU_MAX;
+        }
+    }
+
+    kBenchCores = cores;
+    kBenchArrived = 0;
+
+    if (smp) {
+        for (uint64_t i = 0; i < smp->cpu_count; i++) {
+            struct limine_smp_info *info = smp->cpus[i];
+            if (info->lapic_id != smp->bsp_lapic_id && info->extra_argument < CPU_MAX) {
+                MmAttachCpu();
+                __atomic_store_n(&info->goto_address, BenchSmpEntry, __ATOMIC_RELEASE);
+            }
+        }
+    }
+
+    BenchKmallocWorker(0);
+
+    // Throughput adds up over the cores, it only scales if no core waits on another.
+    uint64_t pairs_per_second = 0, remote_cycles = 0;
+    for (uint32_t core = 0; core < cores; core++) {
+        pairs_per_second += BenchPerSecond(BENCH_KMALLOC_PAIRS, kBenchLocalCycles[core]);
+        remote_cycles += kBenchRemoteCycles[core];
+    }
+
+    ComPrint("[BENCH] kmalloc on %d cores: %D pairs/s in total, %D per core, %D cycles per remote free\n", cores,
+             pairs_per_second, pairs_per_second / cores, remote_cycles / (cores * BENCH_KMALLOC_EXCHANGE));
+
+    KmCpuStatistics statistics;
+    KmGetCpuStatistics(0, &statistics);
+    ComPrint("[BENCH] kmalloc core 0: %D allocations, %D frees, %D remote frees, %D refills, %D drains\n",
+             statistics.allocations, statistics.frees, statistics.remote_frees, statistics.refills,
+             statistics.drains);
+}
+
+#endif
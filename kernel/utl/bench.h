@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+// Boot-time allocator benchmarks, compiled in with `make CPPFLAGS=-DKERNEL_BENCHMARK`.
+
+struct limine_smp_response;
+
+void BenchRunAll(void);
+void BenchRunSmp(struct limine_smp_response *smp);
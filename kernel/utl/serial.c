@@ -59,6 +59,20 @@ void ComPrint(const char *fmt, ...) {
                             div /= 10;
                         }
                     } break;
+                    case 'D': {
+                        string++;
+                        uint64_t num = va_arg(args, uint64_t);
+
+                        uint64_t div = 1;
+                        while (num / div >= 10)
+                            div *= 10;
+
+                        while (div) {
+                            ComPutChar('0' + num / div);
+                            num %= div;
+                            div /= 10;
+                        }
+                    } break;
                     case 'x': {
                         string++;
                         int num = va_arg(args, int);
@@ -72,6 +86,7 @@ void ComPrint(const char *fmt, ...) {
                             ComPutChar("0123456789ABCDEF"[(num >> i) & 0xF]);
                     } break;
                     case '%':
+                        string++;
                         ComPutChar('%');
                         break;
                 }